@@ -0,0 +1,48 @@
+#include <iostream>
+#include <cstdio>
+#include "animation.h"
+#include "savequeue.h"
+#include "stats.h"
+
+string FrameFileName(const string& fname, int n) {
+    char number[16];
+    sprintf(number, "_%04d", n);
+    size_t dot = fname.find_last_of('.');
+    if (dot == string::npos || fname.find_first_of("/\\", dot) != string::npos) {
+        return fname + number;
+    }
+    return fname.substr(0, dot) + number + fname.substr(dot);
+}
+
+int RunAnimation(Scene& scene, const RenderOptions& options) {
+    cout << "Animation: " << options.frames << " frames, " << scene.animatedTransforms.size() << " keyframed transforms.\n";
+    // The next frame is traced while the last one is saved
+    SaveQueue* queue = options.saveQueue > 0? new SaveQueue(options.saveQueue) : NULL;
+    int refits = 0, rebuilds = 0;
+    double fitMs = 0;
+    for (int n = 0; n < options.frames; ++n) {
+        float t = options.frames > 1? (float)n / (options.frames - 1) : 0.0f;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (scene.SetTime(t)) {
+            if (scene.bvh.Refit(scene.objects) && scene.bvh.Cost() <= options.rebuildRatio * scene.bvh.builtCost) {
+                refits++;
+            }
+            else {
+                scene.bvh.Build(scene.objects);
+                rebuilds++;
+            }
+        }
+        fitMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        RenderStats stats;
+        stats.Start();
+        string fname = FrameFileName(scene.resultFile, n);
+        RenderToFile(scene.camera, scene, options, fname, queue);
+        stats.Stop();
+        cout << "Frame " << n << " (t = " << t << "): " << fname << " in " << stats.milliseconds << " ms, BVH cost "
+             << scene.bvh.Cost() / scene.bvh.builtCost << " of its build\n";
+    }
+    delete queue; // Waits for the last images
+    cout << "Animation: " << refits << " BVH refits and " << rebuilds << " rebuilds in " << fitMs << " ms.\n";
+    return options.frames;
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#include "render.h"
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+// Name of frame number n of a sequence, the number goes before the extension: scene.png -> scene_0007.png
+string FrameFileName(const string& fname, int n);
+
+// --frames: renders the scene at the times 0, 1/(N-1) ... 1 of its keyframes into numbered files.
+// Between frames the object BVH is refit to the moved transforms, and built again when a refit
+// can't keep it (an object gained or lost its bounds) or its cost grew past options.rebuildRatio
+// times the cost of the last build. Returns the number of frames
+int RunAnimation(Scene& scene, const RenderOptions& options);
+#endif // ANIMATION_H
\ No newline at end of file
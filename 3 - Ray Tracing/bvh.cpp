@@ -0,0 +1,177 @@
+#include "bvh.h"
+
+// Objects per leaf, below this splitting costs more node tests than it saves
+static const int LEAF_OBJECTS = 4;
+
+Bounds::Bounds() : lower(numeric_limits<float>::infinity()), upper(-numeric_limits<float>::infinity()) {}
+
+void Bounds::Grow(const vec3& point) {
+    for (int k = 0; k < 3; ++k) {
+        lower[k] = min(lower[k], point[k]);
+        upper[k] = max(upper[k], point[k]);
+    }
+}
+
+void Bounds::Grow(const Bounds& other) {
+    Grow(other.lower);
+    Grow(other.upper);
+}
+
+float Bounds::Area() const {
+    vec3 size = upper - lower;
+    if (size[0] < 0 || size[1] < 0 || size[2] < 0) {
+        return 0;
+    }
+    return 2 * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+bool ObjectBounds(const Object* object, Bounds& bounds) {
+    if (object->transform->kind == ObjectTransform::projective) {
+        return false;
+    }
+    bounds = Bounds();
+    if (object->type == Object::sphere) {
+        const Sphere* sphere = (const Sphere*)object;
+        for (int corner = 0; corner < 8; ++corner) {
+            vec3 offset((corner & 1)? sphere->radius : -sphere->radius, (corner & 2)? sphere->radius : -sphere->radius, 
+                (corner & 4)? sphere->radius : -sphere->radius);
+            bounds.Grow(object->transform->ToWorldPoint(sphere->position + offset));
+        }
+    }
+    else {
+        const Triangle* triangle = (const Triangle*)object;
+        for (int k = 0; k < 3; ++k) {
+            bounds.Grow(object->transform->ToWorldPoint(triangle->vertexes[k]));
+        }
+    }
+    // The sphere test takes a slightly negative discriminant, the triangle test slightly negative barycentrics
+    vec3 size = bounds.upper - bounds.lower;
+    float margin = max(size[0], max(size[1], size[2])) * 1e-3f + 1e-4f;
+    bounds.lower = bounds.lower - vec3(margin, margin, margin);
+    bounds.upper = bounds.upper + vec3(margin, margin, margin);
+    return true;
+}
+
+bool RayHitsBounds(const Bounds& bounds, const vec3& origin, const vec3& direction, float tMax) {
+    float tNear = 0, tFar = tMax;
+    for (int k = 0; k < 3; ++k) {
+        if (direction[k] == 0) {
+            if (origin[k] < bounds.lower[k] || origin[k] > bounds.upper[k]) {
+                return false;
+            }
+            continue;
+        }
+        float t0 = (bounds.lower[k] - origin[k]) / direction[k];
+        float t1 = (bounds.upper[k] - origin[k]) / direction[k];
+        tNear = max(tNear, min(t0, t1));
+        tFar = min(tFar, max(t0, t1));
+    }
+    return tNear <= tFar;
+}
+
+bool ConeHitsBounds(const Bounds& bounds, const RayCone& cone, float tMax) {
+    float tNear = 0, tFar = tMax;
+    for (int k = 0; k < 3; ++k) {
+        // Directions of both signs (or 0) give no bound on this axis
+        if (cone.lower[k] <= 0 && cone.upper[k] >= 0) {
+            continue;
+        }
+        // (plane - origin) / d is monotonic in both when d keeps its sign, the extremes are at the ends
+        float a = bounds.lower[k] - cone.origins.upper[k], b = bounds.upper[k] - cone.origins.lower[k];
+        float t[4] = {a / cone.lower[k], a / cone.upper[k], b / cone.lower[k], b / cone.upper[k]};
+        tNear = max(tNear, min(min(t[0], t[1]), min(t[2], t[3])));
+        tFar = min(tFar, max(max(t[0], t[1]), max(t[2], t[3])));
+    }
+    return tNear <= tFar;
+}
+
+void ObjectBVH::Build(const vector<Object*>& objects) {
+    nodes.clear();
+    order.clear();
+    unbounded.clear();
+    vector<Bounds> bounds(objects.size());
+    for (int i = 0; i < (int)objects.size(); ++i) {
+        if (ObjectBounds(objects[i], bounds[i])) {
+            order.push_back(i);
+        }
+        else {
+            unbounded.push_back(i);
+        }
+    }
+    if (!order.empty()) {
+        BuildNode(bounds, 0, order.size());
+    }
+    builtCost = Cost();
+}
+
+bool ObjectBVH::Refit(const vector<Object*>& objects) {
+    Bounds bounds;
+    for (int i = 0; i < (int)unbounded.size(); ++i) {
+        if (ObjectBounds(objects[unbounded[i]], bounds)) {
+            return false;
+        }
+    }
+    // Children come after their parent, so walking backwards fits them first
+    for (int n = (int)nodes.size() - 1; n >= 0; --n) {
+        Node& node = nodes[n];
+        node.bounds = Bounds();
+        if (node.left >= 0) {
+            node.bounds.Grow(nodes[node.left].bounds);
+            node.bounds.Grow(nodes[node.right].bounds);
+            continue;
+        }
+        for (int i = node.first; i < node.first + node.count; ++i) {
+            if (!ObjectBounds(objects[order[i]], bounds)) {
+                return false;
+            }
+            node.bounds.Grow(bounds);
+        }
+    }
+    return true;
+}
+
+float ObjectBVH::Cost() const {
+    if (nodes.empty() || nodes[0].bounds.Area() == 0) {
+        return 0;
+    }
+    float cost = 0;
+    for (int n = 0; n < (int)nodes.size(); ++n) {
+        const Node& node = nodes[n];
+        cost += node.bounds.Area() * (node.left < 0? node.count : 1);
+    }
+    return cost / nodes[0].bounds.Area();
+}
+
+struct CompareCenters {
+    const vector<Bounds>* bounds;
+    int axis;
+    bool operator()(int a, int b) const { return (*bounds)[a].Center()[axis] < (*bounds)[b].Center()[axis]; }
+};
+
+int ObjectBVH::BuildNode(const vector<Bounds>& bounds, int first, int count) {
+    Node node;
+    Bounds centers;
+    for (int i = first; i < first + count; ++i) {
+        node.bounds.Grow(bounds[order[i]]);
+        centers.Grow(bounds[order[i]].Center());
+    }
+    node.left = node.right = -1;
+    node.first = first;
+    node.count = count;
+    vec3 size = centers.upper - centers.lower;
+    node.axis = size[0] > size[1]? (size[0] > size[2]? 0 : 2) : (size[1] > size[2]? 1 : 2);
+    int index = nodes.size();
+    nodes.push_back(node);
+    if (count <= LEAF_OBJECTS) {
+        return index;
+    }
+
+    int half = count / 2;
+    CompareCenters compare = {&bounds, node.axis};
+    nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, compare);
+    int left = BuildNode(bounds, first, half);
+    int right = BuildNode(bounds, first + half, count - half);
+    nodes[index].left = left; // nodes may have moved while building the children
+    nodes[index].right = right;
+    return index;
+}
@@ -0,0 +1,61 @@
+#include <vector>
+#include "geometry.h"
+using namespace std;
+
+#ifndef BVH_H
+#define BVH_H
+
+// Axis aligned box, empty when lower > upper
+struct Bounds {
+    vec3 lower, upper;
+    Bounds();
+    void Grow(const vec3& point);
+    void Grow(const Bounds& other);
+    vec3 Center() const { return (lower + upper) * 0.5f; }
+    float Area() const; // Surface area, 0 when empty
+};
+
+// World space box around the object, a little larger so that the tolerances of the intersection
+// tests stay inside. False when there is none (projective transforms)
+bool ObjectBounds(const Object* object, Bounds& bounds);
+
+// Entry and exit of a ray in the box within [0, tMax], false when it misses
+bool RayHitsBounds(const Bounds& bounds, const vec3& origin, const vec3& direction, float tMax);
+
+// Rays whose origins lie in the box origins and whose directions lie in the box [lower, upper],
+// component by component. Camera rays share a single origin
+struct RayCone {
+    Bounds origins;
+    vec3 lower, upper;
+};
+
+// Interval arithmetic bound: false only when no ray of the cone can enter the box before tMax
+bool ConeHitsBounds(const Bounds& bounds, const RayCone& cone, float tMax);
+
+// Bounding volume hierarchy over the objects of a scene, split at the median of the longest axis
+class ObjectBVH {
+public:
+    struct Node {
+        Bounds bounds;
+        int left, right; // Children, -1 for a leaf
+        int first, count; // Leaf objects in order[first .. first+count-1]
+        int axis; // Split axis, the child on the low side is left
+    };
+    void Build(const vector<Object*>& objects);
+
+    // New bounds for the nodes around the objects where they are now, the tree is kept. False when
+    // an object gained or lost its bounds, then only Build fits
+    bool Refit(const vector<Object*>& objects);
+
+    // Surface area heuristic: node and object tests expected for a ray that crosses the root box,
+    // each node weighted by its area over the root area. It grows as refits stretch the nodes
+    float Cost() const;
+    float builtCost; // Cost right after Build
+
+    vector<Node> nodes;
+    vector<int> order; // Positions in Scene::objects, grouped by leaf
+    vector<int> unbounded; // Objects without bounds, tested by every ray
+private:
+    int BuildNode(const vector<Bounds>& bounds, int first, int count);
+};
+#endif // BVH_H
@@ -0,0 +1,66 @@
+#include "camerarays.h"
+
+CameraRays::CameraRays(const Camera& camera, int _width, int _height) : width(_width), height(_height), eye(camera.eye) {
+    w = glm::normalize(camera.eye - camera.center);
+    u = glm::normalize(glm::cross(camera.up, w));
+    v = glm::cross(w, u);
+
+    // tanY stays a double and tanX is rounded to a float, any other precision moves the rays by a bit
+    float fovy = camera.fovy * PI / 180.0;
+    tanY = tan(fovy / 2.0);
+    tanX = tanY * width / height;
+
+    centerAlpha.resize(width);
+    for (int x = 0; x < width; ++x) {
+        centerAlpha[x] = Alpha(x + 0.5);
+    }
+    centerBeta.resize(height);
+    for (int y = 0; y < height; ++y) {
+        centerBeta[y] = Beta(y + 0.5);
+    }
+}
+
+float CameraRays::Alpha(float j) const {
+    return tanX * (j - width/2.0) / (width / 2.0);
+}
+
+float CameraRays::Beta(float i) const {
+    return tanY * (height/2.0 - i) / (height / 2.0);
+}
+
+Ray CameraRays::RayThrough(float i, float j) const {
+    return Ray(eye, Alpha(j)*u + Beta(i)*v - w);
+}
+
+Ray CameraRays::PixelRay(int x, int y) const {
+    return Ray(eye, centerAlpha[x]*u + centerBeta[y]*v - w);
+}
+
+void CameraRays::TileRays(const Tile& tile, float dx, float dy, RayPacket& packet) const {
+    int count = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+    bool centers = dx == 0.5f && dy == 0.5f;
+    packet.origin = eye;
+    packet.ox.clear();
+    packet.oy.clear();
+    packet.oz.clear();
+    packet.dx.resize(count);
+    packet.dy.resize(count);
+    packet.dz.resize(count);
+    packet.i.resize(count);
+    packet.j.resize(count);
+    int k = 0;
+    for (int y = tile.y0; y < tile.y1; y++) {
+        float i = y + dy;
+        float beta = centers? centerBeta[y] : Beta(i);
+        for (int x = tile.x0; x < tile.x1; x++, k++) {
+            float j = x + dx;
+            float alpha = centers? centerAlpha[x] : Alpha(j);
+            vec3 direction = alpha*u + beta*v - w;
+            packet.dx[k] = direction.x;
+            packet.dy[k] = direction.y;
+            packet.dz[k] = direction.z;
+            packet.i[k] = i;
+            packet.j[k] = j;
+        }
+    }
+}
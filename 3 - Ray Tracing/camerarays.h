@@ -0,0 +1,44 @@
+#include <vector>
+#include "scene.h"
+#include "traversal.h"
+using namespace std;
+
+#ifndef CAMERARAYS_H
+#define CAMERARAYS_H
+
+// Rays of a tile in structure of arrays form, all from the eye, row by row. Reflected rays
+// each have their own origin
+struct RayPacket {
+    vec3 origin;
+    vector<float> ox, oy, oz; // Origin of each ray, empty when they all start at origin
+    vector<float> dx, dy, dz; // Directions, not normalized
+    vector<float> i, j; // Point of the image plane each ray goes through, (row, column)
+    int Size() const { return dx.size(); }
+    vec3 OriginAt(int k) const { return ox.empty()? origin : vec3(ox[k], oy[k], oz[k]); }
+    Ray At(int k) const { return Ray(OriginAt(k), vec3(dx[k], dy[k], dz[k])); }
+};
+
+// Camera basis and field of view factors of a frame, worked out once instead of per ray. The
+// directions through the pixel centers are tabulated per column and row. A ray leaves the eye
+// along alpha u + beta v - w, alpha and beta being the point of the image plane scaled by the
+// tangents of the half field of view
+class CameraRays {
+public:
+    CameraRays(const Camera& camera, int _width, int _height);
+    
+    Ray RayThrough(float i, float j) const; // Any point of the image plane, row i and column j
+    Ray PixelRay(int x, int y) const; // Through the center of pixel (x, y)
+
+    // One ray per pixel of the tile through the sub-pixel point (x + dx, y + dy), 0.5 for the centers
+    void TileRays(const Tile& tile, float dx, float dy, RayPacket& packet) const;
+
+private:
+    float Alpha(float j) const;
+    float Beta(float i) const;
+    int width, height;
+    vec3 eye, u, v, w;
+    float tanX;
+    double tanY;
+    vector<float> centerAlpha, centerBeta; // Alpha of each column center, beta of each row center
+};
+#endif // CAMERARAYS_H
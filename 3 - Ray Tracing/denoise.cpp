@@ -0,0 +1,136 @@
+#include <cmath>
+#include <thread>
+#include "denoise.h"
+
+// Tolerances of the edge stopping weights
+static const float COLOR_SIGMA = 0.5f; // Channel distance of the first pass, halved every pass
+static const int NORMAL_SQUARINGS = 7; // The normal cosine is raised to 2^7 = 128
+static const float DEPTH_SIGMA = 0.02f; // Relative depth difference per pixel of tap distance
+static const float ALBEDO_SIGMA = 0.1f;
+
+// B3 spline, the 1D kernel of the 5x5 taps
+static const float KERNEL[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+DenoiseGuides::DenoiseGuides() : width(0), height(0) {}
+
+void CaptureGuides(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, const FrameBuffer& frame, DenoiseGuides& guides) {
+    int width = frame.width, height = frame.height;
+    guides.width = width;
+    guides.height = height;
+    guides.normals.assign(width * height, vec3(0, 0, 0));
+    guides.depths.assign(width * height, 0.0f);
+    guides.albedos.assign(width * height, Color());
+    // Square packets like TraceTile, a long row of rays culls few BVH nodes
+    int size = ray_tracer.packetSize > 0? ray_tracer.packetSize : 8;
+    RayPacket packet;
+    vector<const Object*> hitObjects(size * size);
+    vector<float> distances(size * size);
+    for (int py = 0 ; py < height ; py += size) {
+        for (int px = 0 ; px < width ; px += size) {
+            Tile part(frame.originX + px, frame.originY + py, frame.originX + min(px + size, width), frame.originY + min(py + size, height));
+            rays.TileRays(part, 0.5, 0.5, packet);
+            ray_tracer.IntersectPacket(packet, scene, &hitObjects[0], &distances[0]);
+            int k = 0;
+            for (int y = part.y0 ; y < part.y1 ; y++) {
+                for (int x = part.x0 ; x < part.x1 ; x++, k++) {
+                    if (hitObjects[k] == NULL) {
+                        continue;
+                    }
+                    int p = (y - frame.originY) * width + x - frame.originX;
+                    Ray ray = packet.At(k);
+                    vec3 hitPoint = ray.origin + ray.direction * distances[k];
+                    const Materials& materials = scene.GetMaterials(hitObjects[k]);
+                    guides.normals[p] = glm::normalize(hitObjects[k]->InterpolatePointNormal(hitPoint));
+                    guides.depths[p] = glm::length(hitPoint - ray.origin);
+                    guides.albedos[p] = materials.diffuse + materials.specular;
+                }
+            }
+        }
+    }
+}
+
+static float SquaredDistance(const Color& a, const Color& b) {
+    float dr = a.r - b.r, dg = a.g - b.g, db = a.b - b.b;
+    return dr * dr + dg * dg + db * db;
+}
+
+// One pass of the filter over the rows [y0, y1), from in to out
+struct DenoisePass {
+    const DenoiseGuides* guides;
+    const Color* in;
+    Color* out;
+    int step;
+    float colorSigma;
+
+    void operator()(int y0, int y1) const {
+        int width = guides->width, height = guides->height;
+        float colorScale = 1.0f / (colorSigma * colorSigma);
+        float albedoScale = 1.0f / (ALBEDO_SIGMA * ALBEDO_SIGMA);
+        for (int y = y0 ; y < y1 ; y++) {
+            for (int x = 0 ; x < width ; x++) {
+                int p = y * width + x;
+                const vec3& normal = guides->normals[p];
+                float depth = guides->depths[p];
+                float depthScale = depth > 0? 1.0f / (depth * DEPTH_SIGMA * step) : 0.0f;
+                Color sum;
+                float total = 0;
+                for (int ky = -2 ; ky <= 2 ; ky++) {
+                    int qy = y + ky * step;
+                    if (qy < 0 || qy >= height) {
+                        continue;
+                    }
+                    for (int kx = -2 ; kx <= 2 ; kx++) {
+                        int qx = x + kx * step;
+                        if (qx < 0 || qx >= width) {
+                            continue;
+                        }
+                        int q = qy * width + qx;
+                        // The background only blends with the background
+                        if ((depth == 0) != (guides->depths[q] == 0)) {
+                            continue;
+                        }
+                        float weight = KERNEL[ky + 2] * KERNEL[kx + 2];
+                        float exponent = SquaredDistance(in[p], in[q]) * colorScale;
+                        if (depth > 0 && q != p) {
+                            float cosine = max(glm::dot(normal, guides->normals[q]), 0.0f);
+                            for (int k = 0 ; k < NORMAL_SQUARINGS ; k++) {
+                                cosine *= cosine;
+                            }
+                            weight *= cosine;
+                            exponent += fabs(depth - guides->depths[q]) * depthScale / (abs(kx) + abs(ky)) +
+                                SquaredDistance(guides->albedos[p], guides->albedos[q]) * albedoScale;
+                        }
+                        weight *= exp(-exponent);
+                        sum = sum + in[q] * weight;
+                        total += weight;
+                    }
+                }
+                // The center tap always counts, total is never 0
+                out[p] = sum * (1.0f / total);
+            }
+        }
+    }
+};
+
+void Denoise(const DenoiseGuides& guides, int passes, FrameBuffer& frame) {
+    int height = frame.height;
+    int threads = max(1, min((int)thread::hardware_concurrency(), height));
+    vector<Color> scratch(frame.colors.size());
+    Color* in = &frame.colors[0];
+    Color* out = &scratch[0];
+    for (int pass = 0 ; pass < passes ; pass++) {
+        DenoisePass filter = {&guides, in, out, 1 << pass, COLOR_SIGMA / (1 << pass)};
+        vector<thread> workers;
+        for (int t = 1 ; t < threads ; t++) {
+            workers.push_back(thread(filter, height * t / threads, height * (t + 1) / threads));
+        }
+        filter(0, height / threads);
+        for (int t = 0 ; t < (int)workers.size() ; t++) {
+            workers[t].join();
+        }
+        swap(in, out);
+    }
+    if (in != &frame.colors[0]) {
+        frame.colors.swap(scratch);
+    }
+}
\ No newline at end of file
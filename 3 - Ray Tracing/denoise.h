@@ -0,0 +1,24 @@
+#include "render.h"
+
+#ifndef DENOISE_H
+#define DENOISE_H
+
+// What the first hit of each pixel center looks like, the edges the denoiser has to keep
+struct DenoiseGuides {
+    int width, height;
+    vector<vec3> normals; // Unit normal at the hit, zero for the background
+    vector<float> depths; // Distance from the eye, 0 for the background
+    vector<Color> albedos; // Diffuse plus specular color of the material
+
+    DenoiseGuides();
+};
+
+// Intersects the pixel centers of the frame in packets, nothing is shaded
+void CaptureGuides(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, const FrameBuffer& frame, DenoiseGuides& guides);
+
+// Edge-avoiding a-trous wavelet filter: passes of a 5x5 B3 spline kernel whose taps are 1, 2, 4 ...
+// pixels apart, each tap weighted by how close its color, normal, depth and albedo are to the center
+// pixel. The color tolerance halves every pass, so the wide passes only smooth what the narrow ones
+// left flat. Each pass splits the rows over the hardware threads
+void Denoise(const DenoiseGuides& guides, int passes, FrameBuffer& frame);
+#endif // DENOISE_H
\ No newline at end of file
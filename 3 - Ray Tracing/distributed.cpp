@@ -0,0 +1,401 @@
+#include <iostream>
+#include <deque>
+#include <cstring>
+#include "distributed.h"
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// Messages are raw structs, so all the machines must share the same byte order
+struct FrameSetup {
+    float camera[10]; // eye, center, up, fovy
+    int width, height, maxDepth;
+    float lightCutoff;
+    int lightSamples;
+    int packetSize;
+    int sortRays;
+    int areaSamples, areaMaxSamples;
+    float time; // Of the keyframes, workers that read the scene file start at 0
+};
+
+struct TileMessage {
+    int x0, y0, x1, y1; // x0 < 0 stops the worker
+};
+
+#ifndef _WIN32
+
+ProcessTransport::ProcessTransport(int _readFd, int _writeFd, int _pid) : readFd(_readFd), writeFd(_writeFd), pid(_pid) {}
+
+ProcessTransport::~ProcessTransport() {
+    close(readFd);
+    if (writeFd != readFd) {
+        close(writeFd);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+void ProcessTransport::Kill() {
+    if (pid > 0) {
+        kill(pid, SIGKILL);
+    }
+}
+
+bool ProcessTransport::Send(const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t n = write(writeFd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool ProcessTransport::Receive(void* data, size_t size) {
+    char* bytes = (char*)data;
+    while (size > 0) {
+        ssize_t n = read(readFd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) { // The worker is gone
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+Transport* StartLocalWorker(const Scene& scene) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        return NULL;
+    }
+    cout.flush();
+    int pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        // The child has its own copy of the scene, the frame setup may change it
+        _exit(RunWorker(fds[1], fds[1], const_cast<Scene&>(scene)));
+    }
+    close(fds[1]);
+    return new ProcessTransport(fds[0], fds[0], pid);
+}
+
+Transport* StartCommandWorker(const string& command) {
+    int toWorker[2], fromWorker[2];
+    if (pipe(toWorker) != 0) {
+        return NULL;
+    }
+    if (pipe(fromWorker) != 0) {
+        close(toWorker[0]);
+        close(toWorker[1]);
+        return NULL;
+    }
+    cout.flush();
+    int pid = fork();
+    if (pid == 0) {
+        dup2(toWorker[0], 0);
+        dup2(fromWorker[1], 1);
+        close(toWorker[0]);
+        close(toWorker[1]);
+        close(fromWorker[0]);
+        close(fromWorker[1]);
+        execl("/bin/sh", "sh", "-c", command.c_str(), (char*)NULL);
+        _exit(127);
+    }
+    close(toWorker[0]);
+    close(fromWorker[1]);
+    if (pid < 0) {
+        close(toWorker[1]);
+        close(fromWorker[0]);
+        return NULL;
+    }
+    return new ProcessTransport(fromWorker[0], toWorker[1], pid);
+}
+
+int RunWorker(int readFd, int writeFd, Scene& scene) {
+    ProcessTransport coordinator(readFd, writeFd, -1);
+    FrameSetup setup;
+    if (!coordinator.Receive(&setup, sizeof(setup))) {
+        return 1;
+    }
+    const float* c = setup.camera;
+    Camera camera(vec3(c[0], c[1], c[2]), vec3(c[3], c[4], c[5]), vec3(c[6], c[7], c[8]), c[9]);
+    scene.width = setup.width;
+    scene.height = setup.height;
+    scene.maxDepth = setup.maxDepth;
+    if (scene.SetTime(setup.time)) {
+        scene.bvh.Build(scene.objects);
+    }
+
+    RayTracer ray_tracer(setup.lightCutoff, setup.lightSamples, setup.packetSize, setup.sortRays != 0, setup.areaSamples, setup.areaMaxSamples);
+    CameraRays rays(camera, scene.width, scene.height);
+    TileMessage request;
+    while (coordinator.Receive(&request, sizeof(request)) && request.x0 >= 0) {
+        Tile tile(request.x0, request.y0, request.x1, request.y1);
+        int width = tile.x1 - tile.x0, height = tile.y1 - tile.y0;
+        FrameBuffer frame(width, height, tile.x0, tile.y0);
+        TraceTile(ray_tracer, rays, scene, tile, frame);
+
+        vector<float> colors(3 * width * height);
+        for (int i = 0; i < width * height; ++i) {
+            colors[3*i + 0] = frame.colors[i].r;
+            colors[3*i + 1] = frame.colors[i].g;
+            colors[3*i + 2] = frame.colors[i].b;
+        }
+        if (!coordinator.Send(&request, sizeof(request)) ||
+            !coordinator.Send(&colors[0], colors.size() * sizeof(float)) ||
+            !coordinator.Send(&frame.objectIds[0], frame.objectIds.size() * sizeof(int))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Reads the answer for the tile into the frame, false when the worker died on the way
+bool ReceiveTile(Transport* transport, const Tile& tile, FrameBuffer& frame) {
+    TileMessage answer;
+    if (!transport->Receive(&answer, sizeof(answer)) || answer.x0 != tile.x0 || answer.y0 != tile.y0) {
+        return false;
+    }
+    int width = tile.x1 - tile.x0, height = tile.y1 - tile.y0;
+    vector<float> colors(3 * width * height);
+    vector<int> objectIds(width * height);
+    if (!transport->Receive(&colors[0], colors.size() * sizeof(float)) ||
+        !transport->Receive(&objectIds[0], objectIds.size() * sizeof(int))) {
+        return false;
+    }
+    // Merged only once the whole tile arrived
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int i = y * width + x;
+            int fx = tile.x0 - frame.originX + x, fy = tile.y0 - frame.originY + y;
+            frame.ColorAt(fx, fy) = Color(colors[3*i + 0], colors[3*i + 1], colors[3*i + 2]);
+            frame.ObjectAt(fx, fy) = objectIds[i];
+        }
+    }
+    return true;
+}
+
+WorkerPool::WorkerPool(const Camera& _camera, const Scene& _scene, const RenderOptions& _options)
+    : camera(_camera), scene(_scene), options(_options), tileCount(0), died(0), local(0) {
+    // A worker that died must not take the coordinator down with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    FrameSetup setup;
+    const vec3* vectors[3] = {&camera.eye, &camera.center, &camera.up};
+    for (int i = 0; i < 3; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            setup.camera[3*i + k] = (*vectors[i])[k];
+        }
+    }
+    setup.camera[9] = camera.fovy;
+    setup.width = scene.width;
+    setup.height = scene.height;
+    setup.maxDepth = scene.maxDepth;
+    setup.lightCutoff = options.lightCutoff;
+    setup.lightSamples = options.lightSamples;
+    setup.packetSize = options.packetSize;
+    setup.sortRays = options.sortRays;
+    setup.areaSamples = options.areaSamples;
+    setup.areaMaxSamples = options.areaMaxSamples;
+    setup.time = scene.time;
+
+    for (int i = 0; i < options.workers; ++i) {
+        workers.push_back(Slot(StartLocalWorker(scene)));
+    }
+    for (int i = 0; i < (int)options.workerCommands.size(); ++i) {
+        workers.push_back(Slot(StartCommandWorker(options.workerCommands[i])));
+    }
+    // A worker that could not start or take the setup counts as died
+    for (int i = 0; i < (int)workers.size(); ++i) {
+        if (workers[i].alive && !workers[i].transport->Send(&setup, sizeof(setup))) {
+            workers[i].alive = false;
+        }
+        if (!workers[i].alive) {
+            died++;
+        }
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    TileMessage stop = {-1, -1, -1, -1};
+    for (int i = 0; i < (int)workers.size(); ++i) {
+        if (workers[i].alive) {
+            workers[i].transport->Send(&stop, sizeof(stop));
+        }
+        delete workers[i].transport;
+    }
+    cout << "Distributed: " << tileCount << " tiles over " << workers.size() << " workers, " 
+         << died << " died, " << local << " tiles traced by the coordinator.\n";
+}
+
+void WorkerPool::Trace(FrameBuffer& frame) {
+    RenderOptions tileOptions = options;
+    if (tileOptions.tileSize == 1) {
+        tileOptions.tileSize = 32;
+    }
+    vector<Tile> tiles;
+    BuildTiles(frame.width, frame.height, tileOptions, tiles, frame.originX, frame.originY);
+    deque<Tile> pending(tiles.begin(), tiles.end());
+    tileCount += tiles.size();
+
+    int done = 0;
+    while (done < (int)tiles.size()) {
+        // Hand a tile to every idle worker
+        for (int i = 0; i < (int)workers.size() && !pending.empty(); ++i) {
+            Slot& worker = workers[i];
+            if (!worker.alive || worker.busy) {
+                continue;
+            }
+            worker.tile = pending.front();
+            TileMessage request = {worker.tile.x0, worker.tile.y0, worker.tile.x1, worker.tile.y1};
+            if (worker.transport->Send(&request, sizeof(request))) {
+                worker.busy = true;
+                worker.due = chrono::steady_clock::now() + chrono::milliseconds((long long)(options.workerTimeout * 1000));
+                pending.pop_front();
+            }
+            else {
+                worker.alive = false;
+                died++;
+            }
+        }
+
+        vector<pollfd> fds;
+        vector<int> slots;
+        for (int i = 0; i < (int)workers.size(); ++i) {
+            if (workers[i].alive && workers[i].busy) {
+                pollfd fd = {workers[i].transport->Descriptor(), POLLIN, 0};
+                fds.push_back(fd);
+                slots.push_back(i);
+            }
+        }
+        // Nobody left to ask, the coordinator finishes the frame itself
+        if (fds.empty()) {
+            RayTracer ray_tracer(options.lightCutoff, options.lightSamples, options.packetSize, options.sortRays, options.areaSamples, options.areaMaxSamples);
+            CameraRays rays(camera, scene.width, scene.height);
+            while (!pending.empty()) {
+                TraceTile(ray_tracer, rays, scene, pending.front(), frame);
+                pending.pop_front();
+                done++;
+                local++;
+            }
+            break;
+        }
+        // Wait until the first busy worker is due at most
+        int wait = -1;
+        if (options.workerTimeout > 0) {
+            Deadline first = workers[slots[0]].due;
+            for (int k = 1; k < (int)slots.size(); ++k) {
+                first = min(first, workers[slots[k]].due);
+            }
+            long long left = chrono::duration_cast<chrono::milliseconds>(first - chrono::steady_clock::now()).count() + 1;
+            wait = (int)min(max(left, 0LL), 1000000000LL);
+        }
+        if (poll(&fds[0], fds.size(), wait) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The workers can't be heard anymore: their tiles go back to the queue and the
+            // coordinator traces the rest on the next turn
+            cerr << "Waiting for the workers failed: " << strerror(errno) << ", tracing the rest here" << endl;
+            for (int i = 0; i < (int)workers.size(); ++i) {
+                if (workers[i].alive && workers[i].busy) {
+                    pending.push_front(workers[i].tile);
+                }
+                if (workers[i].alive) {
+                    workers[i].transport->Kill();
+                    workers[i].alive = false;
+                    died++;
+                }
+                workers[i].busy = false;
+            }
+            continue;
+        }
+
+        for (int k = 0; k < (int)fds.size(); ++k) {
+            if (fds[k].revents == 0) {
+                continue;
+            }
+            Slot& worker = workers[slots[k]];
+            worker.busy = false;
+            if (ReceiveTile(worker.transport, worker.tile, frame)) {
+                done++;
+            }
+            else {
+                cout << "Worker " << slots[k] << " died, its tile goes back to the queue.\n";
+                worker.alive = false;
+                pending.push_front(worker.tile);
+                died++;
+            }
+        }
+
+        // A worker that hangs would hold its tile forever
+        Deadline now = chrono::steady_clock::now();
+        for (int k = 0; k < (int)fds.size() && options.workerTimeout > 0; ++k) {
+            Slot& worker = workers[slots[k]];
+            if (fds[k].revents != 0 || !worker.busy || now < worker.due) {
+                continue;
+            }
+            cout << "Worker " << slots[k] << " sent nothing in " << options.workerTimeout << " s, its tile goes back to the queue.\n";
+            worker.transport->Kill();
+            worker.alive = false;
+            worker.busy = false;
+            pending.push_front(worker.tile);
+            died++;
+        }
+    }
+}
+
+#else // No fork and poll, everything is traced here
+
+ProcessTransport::ProcessTransport(int _readFd, int _writeFd, int _pid) : readFd(_readFd), writeFd(_writeFd), pid(_pid) {}
+ProcessTransport::~ProcessTransport() {}
+bool ProcessTransport::Send(const void* data, size_t size) { return false; }
+bool ProcessTransport::Receive(void* data, size_t size) { return false; }
+void ProcessTransport::Kill() {}
+Transport* StartLocalWorker(const Scene& scene) { return NULL; }
+Transport* StartCommandWorker(const string& command) { return NULL; }
+
+int RunWorker(int readFd, int writeFd, Scene& scene) {
+    cerr << "Workers are not supported on this platform\n";
+    return 1;
+}
+
+WorkerPool::WorkerPool(const Camera& _camera, const Scene& _scene, const RenderOptions& _options)
+    : camera(_camera), scene(_scene), options(_options), tileCount(0), died(0), local(0) {
+    cout << "Workers are not supported on this platform, tracing locally.\n";
+}
+
+WorkerPool::~WorkerPool() {}
+
+void WorkerPool::Trace(FrameBuffer& frame) {
+    RayTracer ray_tracer(options.lightCutoff, options.lightSamples, options.packetSize, options.sortRays, options.areaSamples, options.areaMaxSamples);
+    TraceTile(ray_tracer, CameraRays(camera, scene.width, scene.height), scene, Tile(frame.originX, frame.originY, frame.originX + frame.width, frame.originY + frame.height), frame);
+}
+
+#endif
+
+void TraceDistributed(const Camera& camera, const Scene& scene, const RenderOptions& options, FrameBuffer& frame) {
+    WorkerPool pool(camera, scene, options);
+    pool.Trace(frame);
+}
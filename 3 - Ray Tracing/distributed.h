@@ -0,0 +1,67 @@
+#include <string>
+#include "render.h"
+
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+// Byte stream to one worker. The coordinator only needs blocking sends and receives
+// plus a descriptor to poll, so a socket to another host can plug in the same way
+class Transport {
+public:
+    virtual ~Transport() {}
+    virtual bool Send(const void* data, size_t size) = 0;
+    virtual bool Receive(void* data, size_t size) = 0;
+    virtual int Descriptor() const = 0; // Readable when the worker answered or died
+    virtual void Kill() = 0; // Gives up on a worker that can't be heard, so closing won't wait for it
+};
+
+// Worker process reached through a pair of file descriptors, pid -1 for the coordinator seen from a worker
+class ProcessTransport : public Transport {
+public:
+    ProcessTransport(int _readFd, int _writeFd, int _pid);
+    virtual ~ProcessTransport();
+    virtual bool Send(const void* data, size_t size);
+    virtual bool Receive(void* data, size_t size);
+    virtual int Descriptor() const { return readFd; }
+    virtual void Kill();
+private:
+    int readFd, writeFd, pid;
+};
+
+// Forked copy of this process sharing the parsed scene, over a local socket pair
+Transport* StartLocalWorker(const Scene& scene);
+// Shell command whose stdin/stdout speak the worker protocol, e.g. "ssh host raytracer scene.test --worker"
+Transport* StartCommandWorker(const string& command);
+
+// Answers tile requests until the coordinator stops it, returns the exit code
+int RunWorker(int readFd, int writeFd, Scene& scene);
+
+// Workers started once for a camera and scene, and kept until the pool is deleted so that
+// the bands of a streamed image share them. A worker that died stays out
+class WorkerPool {
+public:
+    WorkerPool(const Camera& _camera, const Scene& _scene, const RenderOptions& _options);
+    ~WorkerPool(); // Stops the workers and prints the totals
+
+    // Splits the frame in tiles, farms them out and merges the results. Tiles of a worker
+    // that dies go back to the queue, and with no worker left the rest is traced here
+    void Trace(FrameBuffer& frame);
+
+private:
+    struct Slot {
+        Transport* transport;
+        bool alive, busy;
+        Tile tile; // Tile being traced when busy
+        Deadline due; // When the tile is given up
+        Slot(Transport* _transport) : transport(_transport), alive(_transport != NULL), busy(false), tile(0, 0, 0, 0) {}
+    };
+    Camera camera;
+    const Scene& scene;
+    RenderOptions options;
+    vector<Slot> workers;
+    int tileCount, died, local;
+};
+
+// One frame on a pool of its own
+void TraceDistributed(const Camera& camera, const Scene& scene, const RenderOptions& options, FrameBuffer& frame);
+#endif // DISTRIBUTED_H
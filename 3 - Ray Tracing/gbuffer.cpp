@@ -0,0 +1,184 @@
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include "gbuffer.h"
+#include "shading.h"
+
+GBuffer::GBuffer() : width(0), height(0), objectCount(0), materialCount(0) {
+    attenuation[0] = 1.0;
+    attenuation[1] = attenuation[2] = 0.0;
+}
+
+template <class T> static bool WriteVector(FILE* file, const vector<T>& v) {
+    unsigned int count = v.size();
+    return fwrite(&count, sizeof(count), 1, file) == 1 && (count == 0 || fwrite(&v[0], sizeof(T), count, file) == count);
+}
+
+template <class T> static bool ReadVector(FILE* file, vector<T>& v) {
+    unsigned int count;
+    if (fread(&count, sizeof(count), 1, file) != 1) {
+        return false;
+    }
+    v.resize(count);
+    return count == 0 || fread(&v[0], sizeof(T), count, file) == count;
+}
+
+// Written in the file so a G-buffer of another build is refused instead of misread
+static const unsigned int GBUFFER_LAYOUT = (sizeof(PathVertex) << 16) | sizeof(Light);
+
+bool GBuffer::Save(const string& fname) const {
+    FILE* file = fopen(fname.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    int header[5] = {width, height, objectCount, materialCount, (int)GBUFFER_LAYOUT};
+    bool ok = fwrite("GBUF", 1, 4, file) == 4 && fwrite(header, sizeof(int), 5, file) == 5 &&
+              fwrite(attenuation, sizeof(float), 3, file) == 3 &&
+              WriteVector(file, lights) && WriteVector(file, firstVertex) && WriteVector(file, vertices);
+    return fclose(file) == 0 && ok;
+}
+
+bool GBuffer::Load(const string& fname) {
+    FILE* file = fopen(fname.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char magic[4];
+    int header[5];
+    bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, "GBUF", 4) == 0 &&
+              fread(header, sizeof(int), 5, file) == 5 && header[4] == (int)GBUFFER_LAYOUT &&
+              fread(attenuation, sizeof(float), 3, file) == 3 &&
+              ReadVector(file, lights) && ReadVector(file, firstVertex) && ReadVector(file, vertices);
+    fclose(file);
+    if (!ok) {
+        return false;
+    }
+    width = header[0];
+    height = header[1];
+    objectCount = header[2];
+    materialCount = header[3];
+    return (int)firstVertex.size() == width * height + 1 && firstVertex.back() == (int)vertices.size();
+}
+
+void CaptureGBuffer(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, GBuffer& gbuffer, FrameBuffer& frame) {
+    gbuffer.width = frame.width;
+    gbuffer.height = frame.height;
+    gbuffer.objectCount = scene.objects.size();
+    gbuffer.materialCount = scene.materialTable.size();
+    gbuffer.lights = scene.lights;
+    for (int k = 0 ; k < 3 ; k++) {
+        gbuffer.attenuation[k] = scene.attenuation[k];
+    }
+    gbuffer.firstVertex.clear();
+    gbuffer.vertices.clear();
+
+    for (int y = 0 ; y < frame.height ; y++) {
+        for (int x = 0 ; x < frame.width ; x++) {
+            gbuffer.firstVertex.push_back(gbuffer.vertices.size());
+            float i = frame.originY + y + 0.5, j = frame.originX + x + 0.5;
+            Ray ray = rays.PixelRay(frame.originX + x, frame.originY + y);
+            const Object* hitObject;
+            frame.ColorAt(x, y) = ray_tracer.GetColor(ray, scene, 0, i, j, &hitObject, &gbuffer.vertices);
+            frame.ObjectAt(x, y) = hitObject == NULL? 0 : hitObject->index;
+        }
+    }
+    gbuffer.firstVertex.push_back(gbuffer.vertices.size());
+}
+
+// Same sums in the same order as GetColor, from the last hit of the chain back to the first. Area lights
+// have no visibility bit, their samples are traced again with the streams of the pixel center (i, j)
+static Color ShadeChain(RayTracer& ray_tracer, const Scene& scene, const PathVertex* chain, int count, float i, float j) {
+    Color reflected = BLACK;
+    vector<int> visibleLights, areaLights;
+    vector<float> weights(scene.lights.size(), 1.0f);
+    for (int k = count - 1 ; k >= 0 ; k--) {
+        const PathVertex& vertex = chain[k];
+        const Materials& materials = scene.materialTable[vertex.materialId];
+        Color color(materials.ambient + materials.emission);
+        visibleLights.clear();
+        areaLights.clear();
+        for (int l = 0; l < (int)scene.lights.size(); ++l) {
+            if (scene.lights[l].IsAreaLight()) {
+                areaLights.push_back(l);
+                continue;
+            }
+            // Lights past the visibility bits are traced every time
+            bool visible = l < 64? (vertex.visibleLights >> l & 1) != 0 : ray_tracer.IsLightVisible(scene.lights[l], scene, vertex.position, l);
+            if (visible) {
+                visibleLights.push_back(l);
+            }
+        }
+        ShadingPoint point(vertex.position, vertex.normal, vertex.viewDirection, materials);
+        if (!visibleLights.empty()) {
+            color = ShadeLights(point, scene.lights, &visibleLights[0], &weights[0], visibleLights.size(), scene.attenuation, color);
+        }
+        for (int a = 0; a < (int)areaLights.size(); ++a) {
+            color = ray_tracer.ShadeAreaLight(scene, areaLights[a], point, 1.0f, i, j, k, color);
+        }
+        if (!materials.specular.isZero()) {
+            color = color + materials.specular * reflected;
+        }
+        reflected = color;
+    }
+    return reflected;
+}
+
+int Relight(RayTracer& ray_tracer, const Scene& scene, GBuffer& gbuffer, FrameBuffer& frame) {
+    // Color and attenuation changes keep the shadows, a new or moved light needs its shadow rays
+    unsigned long long retrace = 0;
+    int retraced = 0;
+    for (int i = 0; i < (int)scene.lights.size() && i < 64; ++i) {
+        if (i >= (int)gbuffer.lights.size() || gbuffer.lights[i].type != scene.lights[i].type ||
+            !(gbuffer.lights[i].position_direction == scene.lights[i].position_direction)) {
+            retrace |= 1ULL << i;
+            retraced++;
+        }
+    }
+    unsigned long long known = scene.lights.size() >= 64? ~0ULL : (1ULL << scene.lights.size()) - 1;
+
+    for (int p = 0 ; p < gbuffer.width * gbuffer.height ; p++) {
+        PathVertex* chain = &gbuffer.vertices[gbuffer.firstVertex[p]];
+        int count = gbuffer.firstVertex[p+1] - gbuffer.firstVertex[p];
+        for (int k = 0 ; k < count && retrace != 0 ; k++) {
+            chain[k].visibleLights &= known & ~retrace;
+            for (int i = 0; i < (int)scene.lights.size() && i < 64; ++i) {
+                if ((retrace >> i & 1) && !scene.lights[i].IsAreaLight() && ray_tracer.IsLightVisible(scene.lights[i], scene, chain[k].position, i)) {
+                    chain[k].visibleLights |= 1ULL << i;
+                }
+            }
+        }
+        frame.colors[p] = ShadeChain(ray_tracer, scene, chain, count, p / gbuffer.width + 0.5f, p % gbuffer.width + 0.5f);
+    }
+
+    gbuffer.lights = scene.lights;
+    for (int k = 0 ; k < 3 ; k++) {
+        gbuffer.attenuation[k] = scene.attenuation[k];
+    }
+    return retraced + max((int)scene.lights.size() - 64, 0);
+}
+
+int RunRelight(const Scene& scene, const RenderOptions& options) {
+    GBuffer gbuffer;
+    if (!gbuffer.Load(options.relightFile)) {
+        cerr << "Reading " << options.relightFile << " failed!" << endl;
+        return 1;
+    }
+    if (gbuffer.width != scene.width || gbuffer.height != scene.height ||
+        gbuffer.objectCount != (int)scene.objects.size() || gbuffer.materialCount != (int)scene.materialTable.size()) {
+        cerr << options.relightFile << " was captured from another geometry or image size" << endl;
+        return 1;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    RayTracer ray_tracer(0.0, 0, options.packetSize, false, options.areaSamples, options.areaMaxSamples);
+    FrameBuffer frame(gbuffer.width, gbuffer.height);
+    int retraced = Relight(ray_tracer, scene, gbuffer, frame);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "Relighting: " << ms << " ms, shadow rays traced for " << retraced << " of " << scene.lights.size() << " lights\n";
+
+    if (!options.gbufferFile.empty() && !gbuffer.Save(options.gbufferFile)) {
+        cerr << "Writing " << options.gbufferFile << " failed!" << endl;
+    }
+    SaveFrame(frame, options, scene.resultFile);
+    return 0;
+}
\ No newline at end of file
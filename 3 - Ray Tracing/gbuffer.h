@@ -0,0 +1,32 @@
+#include "render.h"
+
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+// Hits of the pixel centers and the lights they were shaded with, enough to shade the
+// frame again for new light colors or attenuation without tracing the camera rays
+struct GBuffer {
+    int width, height;
+    vector<int> firstVertex; // The reflection chain of pixel p is vertices[firstVertex[p] .. firstVertex[p+1]-1]
+    vector<PathVertex> vertices;
+    vector<Light> lights;
+    float attenuation[3];
+    int objectCount, materialCount; // Checked against the scene that relights the G-buffer
+
+    GBuffer();
+    // Native byte order and layout, read back by the same build
+    bool Save(const string& fname) const;
+    bool Load(const string& fname);
+};
+
+// Traces the pixel centers like TraceTile and keeps their reflection chains
+void CaptureGBuffer(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, GBuffer& gbuffer, FrameBuffer& frame);
+
+// Shades the G-buffer with the lights of the scene. Shadow rays are only cast for lights that
+// are new or have moved, the others keep the visibility of the capture. The G-buffer is updated
+// to the new lights. Returns the number of lights whose visibility was traced again
+int Relight(RayTracer& ray_tracer, const Scene& scene, GBuffer& gbuffer, FrameBuffer& frame);
+
+// --relight: loads the G-buffer, relights it with the lights of the scene and saves the image
+int RunRelight(const Scene& scene, const RenderOptions& options);
+#endif // GBUFFER_H
\ No newline at end of file
@@ -10,25 +10,19 @@ bool IsSameVector(const vec3& a, const vec3& b) {
     return glm::dot(b-a, b-a) < epsilon;
 }
 
-bool Color::operator == (const Color &otherColor) const {
-    return r == otherColor.r && g == otherColor.g && b == otherColor.b;
-}
-Color Color::operator * (const Color& otherColor) const {
-    return Color(r * otherColor.r, g * otherColor.g, b * otherColor.b);
-}
-Color Color::operator + (const Color& otherColor) const {
-    return Color(r + otherColor.r, g + otherColor.g, b + otherColor.b);
-}
-Color Color::operator * (const float scale) const {
-    return Color(r * scale, g * scale, b * scale);
-}
-bool Color::isZero() const { return Rbyte() == 0 && Gbyte() == 0 && Bbyte() == 0; }
-
 Materials::Materials() : shininess(0.0) {}
+bool Materials::operator == (const Materials& otherMaterials) const {
+    return ambient == otherMaterials.ambient && diffuse == otherMaterials.diffuse && specular == otherMaterials.specular &&
+        emission == otherMaterials.emission && shininess == otherMaterials.shininess;
+}
 
 Ray::Ray(const vec3& _origin, const vec3& _direction) : origin(_origin), direction(_direction) {}
 
-Object::Object() : transform(1.0), InversedTransform(1.0) {}
+bool IsSameParameter(const Ray& ray, float t0, float t1) {
+    return (t1-t0) * (t1-t0) * glm::dot(ray.direction, ray.direction) < epsilon;
+}
+
+Object::Object() : transform(&IDENTITY_TRANSFORM), materialId(0) {}
 
 bool Object::Intersect(const Ray& ray, float* distance) const {
     std::cerr << "Ray should not intersect with abstract object" << std::endl;
@@ -79,9 +73,81 @@ vec3 vec3TimeMat4(const vec3& a, const mat4& mat) {
 vec3 ray3TimeMat4(const vec3& a, const mat4& mat) {
     return vec3(vec4(a, 0.0f) * mat);
 }
+// Row vector times the upper 3x3 part plus the translation column, without the divide by w
+vec3 affineTimeMat4(const vec3& a, const mat4& mat) {
+    return vec3(glm::dot(a, vec3(mat[0])) + mat[0][3], glm::dot(a, vec3(mat[1])) + mat[1][3], glm::dot(a, vec3(mat[2])) + mat[2][3]);
+}
+
+const ObjectTransform IDENTITY_TRANSFORM(mat4(1.0));
+
+ObjectTransform::ObjectTransform(const mat4& _transform) : transform(_transform), InversedTransform(glm::inverse(_transform)) {
+    // Matrices multiply row vectors, so the translation lives in the fourth column
+    if (transform[3] != vec4(0.0, 0.0, 0.0, 1.0)) {
+        kind = projective;
+        return;
+    }
+    bool diagonal = true;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            if (i != j && transform[i][j] != 0.0) {
+                diagonal = false;
+            }
+        }
+    }
+    bool translated = transform[0][3] != 0.0 || transform[1][3] != 0.0 || transform[2][3] != 0.0;
+    if (!diagonal || transform[0][0] != transform[1][1] || transform[0][0] != transform[2][2]) {
+        kind = affine;
+    } 
+    else if (transform[0][0] != 1.0) {
+        kind = uniformScale;
+    } 
+    else {
+        kind = translated? translation : identity;
+    }
+}
+
+vec3 ObjectTransform::ToObjectPoint(const vec3& point) const {
+    switch (kind) {
+        case identity: return point;
+        case translation: return point + vec3(InversedTransform[0][3], InversedTransform[1][3], InversedTransform[2][3]);
+        case uniformScale: return point * InversedTransform[0][0] + vec3(InversedTransform[0][3], InversedTransform[1][3], InversedTransform[2][3]);
+        case affine: return affineTimeMat4(point, InversedTransform);
+        default: return vec3TimeMat4(point, InversedTransform);
+    }
+}
+
+vec3 ObjectTransform::ToObjectDirection(const vec3& direction) const {
+    switch (kind) {
+        case identity: 
+        case translation: return direction;
+        case uniformScale: return direction * InversedTransform[0][0];
+        default: return ray3TimeMat4(direction, InversedTransform);
+    }
+}
+
+vec3 ObjectTransform::ToWorldPoint(const vec3& point) const {
+    switch (kind) {
+        case identity: return point;
+        case translation: return point + vec3(transform[0][3], transform[1][3], transform[2][3]);
+        case uniformScale: return point * transform[0][0] + vec3(transform[0][3], transform[1][3], transform[2][3]);
+        case affine: return affineTimeMat4(point, transform);
+        default: return vec3TimeMat4(point, transform);
+    }
+}
+
+// Normals go through the transpose of the inverse
+vec3 ObjectTransform::ToWorldNormal(const vec3& normal) const {
+    switch (kind) {
+        case identity: 
+        case translation: return normal;
+        case uniformScale: return normal * InversedTransform[0][0];
+        default: return vec3(vec4(normal, 0.0f) * glm::transpose(InversedTransform));
+    }
+}
+
 vec3 Sphere::InterpolatePointNormal(const vec3& point) const {
-    vec3 p = vec3TimeMat4(point, this->InversedTransform);
-    return vec3(vec4(p-position, 0.0f) * glm::transpose(this->InversedTransform));
+    vec3 p = transform->ToObjectPoint(point);
+    return transform->ToWorldNormal(p-position);
 }
 
 Triangle::Triangle(const vec3& _a, const vec3& _b, const vec3& _c, vec3 _na, vec3 _nb, vec3 _nc) : 
@@ -141,7 +207,7 @@ bool Triangle::Intersect(const Ray& ray, float* distance) const {
 	}
 }
 vec3 Triangle::InterpolatePointNormal(const vec3& point) const {
-    vec3 p = vec3TimeMat4(point, this->InversedTransform);
+    vec3 p = transform->ToObjectPoint(point);
     vec3 n = glm::cross(b-a, c-a);
     vec3 tmp_nb = glm::cross(c-p, a-p);
     vec3 tmp_nc = glm::cross(a-p, b-p);
@@ -150,7 +216,7 @@ vec3 Triangle::InterpolatePointNormal(const vec3& point) const {
     float gamma = glm::dot(n, tmp_nc) / glm::dot(n,n);
     float alpha = 1.0 - beta - gamma;
     vec3 ret = (na * alpha) + (nb * beta) + (nc * gamma);
-    return vec3(vec4(ret, 0.0f) * glm::transpose(this->InversedTransform));
+    return transform->ToWorldNormal(ret);
 }
 
 Object::~Object() {
@@ -25,6 +25,9 @@ struct Ray {
     Ray(const vec3& _origin, const vec3& _direction);
 };
 
+// Same test as IsSameVector for two points along the same ray, given by their parameters
+bool IsSameParameter(const Ray& ray, float t0, float t1);
+
 struct Color
 {
 	float r, g, b;
@@ -33,11 +36,12 @@ struct Color
     BYTE Rbyte() const { return std::min(r, 1.0f) * 255; }
     BYTE Gbyte() const { return std::min(g, 1.0f) * 255; }
     BYTE Bbyte() const { return std::min(b, 1.0f) * 255; }
-    bool operator == (const Color& otherColor) const;
-    Color operator * (const Color& otherColor) const;
-    Color operator + (const Color& otherColor) const;
-    Color operator * (const float scale) const;
-    bool isZero() const;
+    // Inline so the channels of a shading expression can share vector registers
+    bool operator == (const Color& otherColor) const { return r == otherColor.r && g == otherColor.g && b == otherColor.b; }
+    Color operator * (const Color& otherColor) const { return Color(r * otherColor.r, g * otherColor.g, b * otherColor.b); }
+    Color operator + (const Color& otherColor) const { return Color(r + otherColor.r, g + otherColor.g, b + otherColor.b); }
+    Color operator * (const float scale) const { return Color(r * scale, g * scale, b * scale); }
+    bool isZero() const { return Rbyte() == 0 && Gbyte() == 0 && Bbyte() == 0; }
 };
 
 const Color BLACK(0, 0, 0);
@@ -51,13 +55,32 @@ struct Materials {
     Color emission; 
     float shininess;
     Materials();
+    bool operator == (const Materials& otherMaterials) const;
+};
+typedef unsigned int MaterialId; // Index into Scene::materialTable
+
+// Object to world matrix shared by all the objects created under the same transform.
+// The kind lets the hot paths skip the matrix work they don't need
+struct ObjectTransform {
+    mat4 transform;
+    mat4 InversedTransform;
+
+    enum Kind {identity, translation, uniformScale, affine, projective};
+    Kind kind;
+    
+    ObjectTransform(const mat4& _transform);
+    vec3 ToObjectPoint(const vec3& point) const;
+    vec3 ToObjectDirection(const vec3& direction) const;
+    vec3 ToWorldPoint(const vec3& point) const;
+    vec3 ToWorldNormal(const vec3& normal) const;
 };
 
+extern const ObjectTransform IDENTITY_TRANSFORM;
+
 class Object {
 public:
-	mat4 transform; 
-    mat4 InversedTransform;
-    Materials materials;        
+    const ObjectTransform* transform; // Entry of Scene::transformTable
+    MaterialId materialId; // Shared entry in the scene material table
     
     int index; // Identify the object for debugging
     
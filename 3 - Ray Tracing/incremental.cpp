@@ -0,0 +1,215 @@
+#include <iostream>
+#include "incremental.h"
+
+IncrementalFrame::IncrementalFrame() : frame(0, 0), maxDepth(-1) {}
+
+static bool SameShape(const Object* a, const Object* b) {
+    if (a->type != b->type || !(a->transform->transform == b->transform->transform)) {
+        return false;
+    }
+    if (a->type == Object::sphere) {
+        const Sphere* sa = (const Sphere*)a;
+        const Sphere* sb = (const Sphere*)b;
+        return sa->position == sb->position && sa->radius == sb->radius;
+    }
+    const Triangle* ta = (const Triangle*)a;
+    const Triangle* tb = (const Triangle*)b;
+    for (int k = 0 ; k < 3 ; k++) {
+        if (!(ta->vertexes[k] == tb->vertexes[k]) || !(ta->vertexNormals[k] == tb->vertexNormals[k])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DiffObjects(const Scene& before, const Scene& after, vector<int>& moved, vector<int>& recolored) {
+    moved.clear();
+    recolored.clear();
+    if (before.objects.size() != after.objects.size()) {
+        return false;
+    }
+    for (int i = 0; i < (int)after.objects.size(); ++i) {
+        if (!SameShape(before.objects[i], after.objects[i])) {
+            moved.push_back(after.objects[i]->index);
+        }
+        else if (!(before.GetMaterials(before.objects[i]) == after.GetMaterials(after.objects[i]))) {
+            recolored.push_back(after.objects[i]->index);
+        }
+    }
+    return true;
+}
+
+static bool SameLights(const Scene& scene, const GBuffer& gbuffer) {
+    if (scene.lights.size() != gbuffer.lights.size()) {
+        return false;
+    }
+    for (int k = 0 ; k < 3 ; k++) {
+        if (scene.attenuation[k] != gbuffer.attenuation[k]) {
+            return false;
+        }
+    }
+    for (int i = 0; i < (int)scene.lights.size(); ++i) {
+        const Light& a = scene.lights[i];
+        const Light& b = gbuffer.lights[i];
+        if (a.type != b.type || !(a.position_direction == b.position_direction) || !(a.color == b.color) ||
+            !(a.edgeU == b.edgeU) || !(a.edgeV == b.edgeV) || a.radius != b.radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Same closest hit test as GetIntersection: an object changes the segment when it is hit before tEnd or at the same point
+static bool Crosses(RayTracer& ray_tracer, const vector<const Object*>& objects, const Ray& ray, float tEnd) {
+    for (int i = 0; i < (int)objects.size(); ++i) {
+        float t;
+        if (ray_tracer.IntersectObject(ray, objects[i], &t) && (t <= tEnd || IsSameParameter(ray, t, tEnd))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The shadow rays of an area light fill the hull of the light and the point, this box holds it. Objects
+// without bounds may be anywhere
+static bool CrossesAreaLight(const vector<const Object*>& objects, const Light& light, const vec3& point) {
+    Bounds volume;
+    volume.Grow(point);
+    vec3 radius(light.radius, light.radius, light.radius);
+    volume.Grow(light.position() - radius);
+    volume.Grow(light.position() + radius);
+    for (int k = 0 ; k < 4 ; k++) {
+        volume.Grow(light.position() + light.edgeU * ((k & 1)? 0.5f : -0.5f) + light.edgeV * ((k & 2)? 0.5f : -0.5f));
+    }
+    for (int i = 0; i < (int)objects.size(); ++i) {
+        Bounds bounds;
+        if (!ObjectBounds(objects[i], bounds)) {
+            return true;
+        }
+        bool apart = false;
+        for (int k = 0 ; k < 3 ; k++) {
+            apart = apart || bounds.upper[k] < volume.lower[k] || bounds.lower[k] > volume.upper[k];
+        }
+        if (!apart) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Walks the rays GetColor traced for the chain, with the lights and materials of the previous render
+static bool TouchesMoved(RayTracer& ray_tracer, const Scene& previous, const GBuffer& gbuffer, const Ray& cameraRay,
+                         const PathVertex* chain, int count, int maxDepth, const vector<const Object*>& objects) {
+    const float far = numeric_limits<float>::infinity();
+    Ray ray = cameraRay;
+    for (int k = 0 ; k < count ; k++) {
+        const PathVertex& vertex = chain[k];
+        if (k > 0) {
+            ray = Ray(chain[k-1].position, vertex.viewDirection);
+        }
+        float tHit = glm::dot(vertex.position - ray.origin, ray.direction) / glm::dot(ray.direction, ray.direction);
+        if (Crosses(ray_tracer, objects, ray, tHit)) {
+            return true;
+        }
+        for (int i = 0; i < (int)gbuffer.lights.size(); ++i) {
+            const Light& light = gbuffer.lights[i];
+            if (light.IsAreaLight()) {
+                if (CrossesAreaLight(objects, light, vertex.position)) {
+                    return true;
+                }
+                continue;
+            }
+            bool crossed = light.type == Light::point?
+                Crosses(ray_tracer, objects, Ray(light.position(), vertex.position - light.position()), 1.0) :
+                Crosses(ray_tracer, objects, Ray(vertex.position, vertex.position - light.direction()), far);
+            if (crossed) {
+                return true;
+            }
+        }
+    }
+
+    // The last ray of the tree found nothing, anything on it now changes the pixel
+    if (count == 0) {
+        return Crosses(ray_tracer, objects, cameraRay, far);
+    }
+    const PathVertex& last = chain[count-1];
+    if (count <= maxDepth && !previous.materialTable[last.materialId].specular.isZero()) {
+        Ray reflected = ray_tracer.GenerateReflectedRay(Ray(last.position, last.viewDirection), last.position, last.normal);
+        return Crosses(ray_tracer, objects, reflected, far);
+    }
+    return false;
+}
+
+int RenderIncremental(RayTracer& ray_tracer, const Scene& scene, const Scene* previous, IncrementalFrame& state) {
+    int width = scene.width, height = scene.height;
+    const Camera& camera = scene.camera;
+    CameraRays rays(camera, width, height);
+    vector<int> moved, recolored;
+    bool comparable = previous != NULL && state.frame.width == width && state.frame.height == height &&
+        state.maxDepth == scene.maxDepth && state.camera.eye == camera.eye && state.camera.center == camera.center &&
+        state.camera.up == camera.up && state.camera.fovy == camera.fovy && DiffObjects(*previous, scene, moved, recolored);
+
+    state.camera = camera;
+    state.maxDepth = scene.maxDepth;
+    if (!comparable) {
+        state.frame = FrameBuffer(width, height);
+        CaptureGBuffer(ray_tracer, rays, scene, state.gbuffer, state.frame);
+        return width * height;
+    }
+
+    // Both places of a moved object matter, where it stopped rays before and where it can stop them now
+    vector<const Object*> movedObjects;
+    vector<bool> isRecolored(scene.objects.size() + 1, false);
+    for (int i = 0; i < (int)moved.size(); ++i) {
+        movedObjects.push_back(previous->objects[moved[i] - 1]);
+        movedObjects.push_back(scene.objects[moved[i] - 1]);
+    }
+    for (int i = 0; i < (int)recolored.size(); ++i) {
+        isRecolored[recolored[i]] = true;
+    }
+
+    GBuffer& gbuffer = state.gbuffer;
+    vector<int> firstVertex;
+    vector<PathVertex> vertices;
+    firstVertex.reserve(gbuffer.firstVertex.size());
+    vertices.reserve(gbuffer.vertices.size());
+    int traced = 0;
+    for (int y = 0 ; y < height ; y++) {
+        for (int x = 0 ; x < width ; x++) {
+            int p = y * width + x;
+            const PathVertex* chain = &gbuffer.vertices[0] + gbuffer.firstVertex[p];
+            int count = gbuffer.firstVertex[p+1] - gbuffer.firstVertex[p];
+            firstVertex.push_back(vertices.size());
+
+            Ray ray = rays.PixelRay(x, y);
+            bool affected = !movedObjects.empty() && TouchesMoved(ray_tracer, *previous, gbuffer, ray, chain, count, scene.maxDepth, movedObjects);
+            for (int k = 0 ; k < count && !affected ; k++) {
+                affected = isRecolored[chain[k].objectIndex];
+            }
+
+            if (affected) {
+                const Object* hitObject;
+                state.frame.ColorAt(x, y) = ray_tracer.GetColor(ray, scene, 0, y+0.5, x+0.5, &hitObject, &vertices);
+                state.frame.ObjectAt(x, y) = hitObject == NULL? 0 : hitObject->index;
+                traced++;
+                continue;
+            }
+            // Material ids follow the edited scene, its table may be numbered differently
+            for (int k = 0 ; k < count ; k++) {
+                vertices.push_back(chain[k]);
+                vertices.back().materialId = scene.objects[chain[k].objectIndex - 1]->materialId;
+            }
+        }
+    }
+    firstVertex.push_back(vertices.size());
+    gbuffer.firstVertex.swap(firstVertex);
+    gbuffer.vertices.swap(vertices);
+    gbuffer.objectCount = scene.objects.size();
+    gbuffer.materialCount = scene.materialTable.size();
+
+    // Traced pixels already see the new lights, shading them again gives the same colors
+    if (!SameLights(scene, gbuffer)) {
+        Relight(ray_tracer, scene, gbuffer, state.frame);
+    }
+    return traced;
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#include "gbuffer.h"
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+// Last render of a scene: colors of the pixel centers, their ray trees and the view they were traced from
+struct IncrementalFrame {
+    GBuffer gbuffer;
+    FrameBuffer frame;
+    Camera camera;
+    int maxDepth;
+
+    IncrementalFrame();
+};
+
+// Indices (Object::index) of the objects whose shape or transform differ between the scenes, and of
+// those whose material only differs. False when the objects don't pair up one to one
+bool DiffObjects(const Scene& before, const Scene& after, vector<int>& moved, vector<int>& recolored);
+
+// Re-traces the pixels whose ray tree (camera, reflected and shadow rays) crosses a moved object,
+// before or after the edit, or hits a recolored one, then relights the frame when the lights changed.
+// Without a comparable previous scene everything is traced. Returns the number of traced pixels
+int RenderIncremental(RayTracer& ray_tracer, const Scene& scene, const Scene* previous, IncrementalFrame& state);
+#endif // INCREMENTAL_H
\ No newline at end of file
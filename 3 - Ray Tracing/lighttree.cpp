@@ -0,0 +1,100 @@
+#include "lighttree.h"
+#include "scene.h"
+
+// Leaves small enough that testing their lights one by one is cheaper than more nodes
+static const int LEAF_LIGHTS = 4;
+
+float LightIntensity(const Light& light) {
+    return max(light.color.r, max(light.color.g, light.color.b));
+}
+
+float AttenuationAt(const float* attenuation, float d) {
+    return attenuation[0] + attenuation[1] * d + attenuation[2] * d * d;
+}
+
+void LightTree::Build(const vector<Light>& lights) {
+    nodes.clear();
+    order.clear();
+    always.clear();
+    for (int i = 0; i < (int)lights.size(); ++i) {
+        if (lights[i].type == Light::point) {
+            order.push_back(i);
+        }
+        else {
+            always.push_back(i);
+        }
+    }
+    if (!order.empty()) {
+        BuildNode(lights, 0, order.size());
+    }
+}
+
+struct CompareAlongAxis {
+    const vector<Light>* lights;
+    int axis;
+    bool operator()(int a, int b) const { return (*lights)[a].position()[axis] < (*lights)[b].position()[axis]; }
+};
+
+// Splits at the median of the longest axis of the bounds
+int LightTree::BuildNode(const vector<Light>& lights, int first, int count) {
+    Node node;
+    node.lower = node.upper = lights[order[first]].position();
+    node.intensity = 0;
+    for (int i = first; i < first + count; ++i) {
+        const vec3& p = lights[order[i]].position();
+        for (int k = 0; k < 3; ++k) {
+            node.lower[k] = min(node.lower[k], p[k]);
+            node.upper[k] = max(node.upper[k], p[k]);
+        }
+        node.intensity += LightIntensity(lights[order[i]]);
+    }
+    node.left = node.right = -1;
+    node.first = first;
+    node.count = count;
+    int index = nodes.size();
+    nodes.push_back(node);
+    if (count <= LEAF_LIGHTS) {
+        return index;
+    }
+
+    vec3 size = node.upper - node.lower;
+    int axis = size[0] > size[1]? (size[0] > size[2]? 0 : 2) : (size[1] > size[2]? 1 : 2);
+    int half = count / 2;
+    CompareAlongAxis compare = {&lights, axis};
+    nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, compare);
+    int left = BuildNode(lights, first, half);
+    int right = BuildNode(lights, first + half, count - half);
+    nodes[index].left = left; // nodes may have moved while building the children
+    nodes[index].right = right;
+    return index;
+}
+
+void LightTree::Collect(const vec3& point, const float* attenuation, float cutoff, float scale, vector<int>& selected) const {
+    selected = always;
+    if (nodes.empty()) {
+        return;
+    }
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        // Closest point of the bounds, the brightest any light of the node can be here
+        vec3 closest;
+        for (int k = 0; k < 3; ++k) {
+            closest[k] = min(max(point[k], node.lower[k]), node.upper[k]);
+        }
+        if (node.intensity * scale / AttenuationAt(attenuation, glm::length(closest - point)) < cutoff) {
+            continue;
+        }
+        if (node.left < 0) {
+            selected.insert(selected.end(), order.begin() + node.first, order.begin() + node.first + node.count);
+        }
+        else {
+            stack[top++] = node.left;
+            stack[top++] = node.right;
+        }
+    }
+    // Same summation order as the loop over all the lights
+    sort(selected.begin(), selected.end());
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include <vector>
+#include "geometry.h"
+using namespace std;
+
+#ifndef LIGHTTREE_H
+#define LIGHTTREE_H
+
+struct Light;
+
+// Brightest channel of the light color
+float LightIntensity(const Light& light);
+// Denominator of the point light falloff at distance d
+float AttenuationAt(const float* attenuation, float d);
+
+// Bounding volume hierarchy over the point lights. A hit point skips a whole group of lights
+// when their summed intensity, attenuated from the closest corner of the group, is below the cutoff
+class LightTree {
+public:
+    void Build(const vector<Light>& lights);
+
+    // Indices of the lights that may give more than cutoff at the point, in increasing order.
+    // Directional lights don't fade and area lights reach closer than their center, both are always
+    // kept. scale bounds what the material reflects
+    void Collect(const vec3& point, const float* attenuation, float cutoff, float scale, vector<int>& selected) const;
+
+private:
+    struct Node {
+        vec3 lower, upper; // Bounds of the light positions
+        float intensity; // Sum of LightIntensity over the node
+        int left, right; // Children, -1 for a leaf
+        int first, count; // Leaf lights in order[first .. first+count-1]
+    };
+    int BuildNode(const vector<Light>& lights, int first, int count);
+    vector<Node> nodes;
+    vector<int> order; // Point light indices, grouped by leaf
+    vector<int> always; // Directional and area lights
+};
+#endif // LIGHTTREE_H
\ No newline at end of file
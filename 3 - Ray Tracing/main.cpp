@@ -9,56 +9,75 @@
 
 using namespace std;
 
-#include "raytracer.h"
+#include "render.h"
+#include "server.h"
+#include "distributed.h"
+#include "tonemap.h"
+#include "stats.h"
+#include "gbuffer.h"
+#include "animation.h"
 
-void SaveScreenshot(string fname, BYTE* image, int width, int height) {
-        
-        FIBITMAP* img = FreeImage_ConvertFromRawBits(image, width, height, width * 3, 24, 0xFF0000, 0x00FF00, 0x0000FF, false);
-        
-        std::cout << "Saving screenshot: " << fname << "\n";
 
-        FreeImage_Save(FIF_PNG, img, fname.c_str(), 0);
-}
+int main(int argc, char* argv[]) {
 
-BYTE* RayTrace (Camera camera, const Scene& scene)  {
-        RayTracer ray_tracer;
-        int width = scene.width;
-        int height = scene.height;
-        int pix = width * height;
-        BYTE* image = new BYTE[3*pix];
+    RenderOptions options;
+    if (!ParseOptions(argc, argv, options) || (options.sceneFile.empty() && !options.server && options.toneMapInput.empty())) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
 
-        for (int y = 0 ; y < height ; y++) {
-			for (int x = 0 ; x < width ; x++) { 
-				Ray ray = ray_tracer.RayThruPixel(camera, y+0.5, x+0.5, height, width);
-                Color color = ray_tracer.GetColor(ray, scene, 0, y+0.5, x+0.5);
-                int base = 3 * ((height-y-1) * width + x);
-                
-				image[base + 0] = color.Bbyte();
-                image[base + 1] = color.Gbyte();
-                image[base + 2] = color.Rbyte();
-                
-			}
-		}
-        return image;
-}
+    FreeImage_Initialise();
 
-int main(int argc, char* argv[]) {
+    if (!options.toneMapInput.empty()) {
+        int code = RunToneMap(options);
+        FreeImage_DeInitialise();
+        return code;
+    }
 
-    FreeImage_Initialise();
+    if (options.server) {
+        RunServer(cin, options);
+        FreeImage_DeInitialise();
+        return 0;
+    }
+        
+    // In worker mode stdout carries the tiles, the messages go to stderr
+    if (options.worker) {
+        cout.rdbuf(cerr.rdbuf());
+    }
         
     Scene scene;
-    scene.readfile(argv[1]);
+    scene.readfile(options.sceneFile);
+
+    if (options.worker) {
+        int code = RunWorker(0, 1, scene);
+        FreeImage_DeInitialise();
+        return code;
+    }
 
-	cout << "Objects: " << scene.objects.size() << "; Lights: " << scene.lights.size() << "; Pixels: " << scene.width*scene.height << ";\n";
+    if (!options.relightFile.empty()) {
+        int code = RunRelight(scene, options);
+        FreeImage_DeInitialise();
+        return code;
+    }
+
+	cout << "Objects: " << scene.objects.size() << "; Materials: " << scene.materialTable.size() << "; Lights: " << scene.lights.size() << "; Pixels: " << scene.width*scene.height << ";\n";
     cout << "Starting Recursive Ray Tracing.\n";
     
-    BYTE* image = RayTrace(scene.camera, scene);
-    SaveScreenshot(scene.resultFile, image, scene.width, scene.height);
+    RenderStats stats;
+    stats.Start();
+    if (options.frames > 0) {
+        RunAnimation(scene, options);
+    }
+    else {
+        RenderToFile(scene.camera, scene, options, scene.resultFile);
+    }
+    stats.Stop();
+    if (options.stats) {
+        stats.Print(cout);
+    }
 
 	cout << "Recursive Ray Tracing completed.\n";
 
-    delete image;
-    
     FreeImage_DeInitialise();
     return 0;
 
@@ -0,0 +1,208 @@
+#include <iostream>
+#include <stdlib.h>
+#include "options.h"
+
+RenderOptions::RenderOptions() : order(rowMajor), tileSize(1), aaSamples(1), aaThreshold(0.1), timeBudgetMs(0), bandHeight(0), cropX0(0), cropY0(0), cropX1(0), cropY1(0), cropFull(false), toneOperator(clampTone), exposure(0.0), gamma(1.0), lightCutoff(0.0), lightSamples(0), packetSize(8), sortRays(false), areaSamples(4), areaMaxSamples(64), denoisePasses(0), frames(0), rebuildRatio(1.5), stats(false), server(false), cacheSize(4), incremental(false), saveQueue(0), workers(0), workerTimeout(60), worker(false) {}
+
+bool ParseOptions(int argc, char* argv[], RenderOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--order" && hasValue) {
+            string order = argv[++i];
+            if (order == "row") {
+                options.order = RenderOptions::rowMajor;
+            }
+            else if (order == "morton") {
+                options.order = RenderOptions::morton;
+            }
+            else if (order == "hilbert") {
+                options.order = RenderOptions::hilbert;
+            }
+            else {
+                cerr << "Unknown traversal order: " << order << "\n";
+                return false;
+            }
+        }
+        else if (arg == "--tile" && hasValue) {
+            options.tileSize = atoi(argv[++i]);
+            if (options.tileSize < 1) {
+                cerr << "Tile size must be at least 1\n";
+                return false;
+            }
+        }
+        else if (arg == "--aa" && hasValue) {
+            options.aaSamples = atoi(argv[++i]);
+            if (options.aaSamples < 1) {
+                cerr << "Anti-aliasing needs at least 1 sample\n";
+                return false;
+            }
+        }
+        else if (arg == "--aa-threshold" && hasValue) {
+            options.aaThreshold = atof(argv[++i]);
+        }
+        else if (arg == "--time-budget-ms" && hasValue) {
+            options.timeBudgetMs = atoi(argv[++i]);
+        }
+        else if (arg == "--band" && hasValue) {
+            options.bandHeight = atoi(argv[++i]);
+        }
+        else if (arg == "--crop" && i + 4 < argc) {
+            options.cropX0 = atoi(argv[++i]);
+            options.cropY0 = atoi(argv[++i]);
+            options.cropX1 = atoi(argv[++i]);
+            options.cropY1 = atoi(argv[++i]);
+            if (options.cropX0 < 0 || options.cropY0 < 0 || options.cropX1 <= options.cropX0 || options.cropY1 <= options.cropY0) {
+                cerr << "The crop window needs 0 <= x0 < x1 and 0 <= y0 < y1\n";
+                return false;
+            }
+        }
+        else if (arg == "--crop-full") {
+            options.cropFull = true;
+        }
+        else if (arg == "--hdr" && hasValue) {
+            options.hdrFile = argv[++i];
+        }
+        else if (arg == "--tone" && hasValue) {
+            string tone = argv[++i];
+            if (tone == "clamp") {
+                options.toneOperator = RenderOptions::clampTone;
+            }
+            else if (tone == "reinhard") {
+                options.toneOperator = RenderOptions::reinhardTone;
+            }
+            else {
+                cerr << "Unknown tone operator: " << tone << "\n";
+                return false;
+            }
+        }
+        else if (arg == "--exposure" && hasValue) {
+            options.exposure = atof(argv[++i]);
+        }
+        else if (arg == "--gamma" && hasValue) {
+            options.gamma = atof(argv[++i]);
+            if (options.gamma <= 0.0) {
+                cerr << "Gamma must be positive\n";
+                return false;
+            }
+        }
+        else if (arg == "--tonemap" && i + 2 < argc) {
+            options.toneMapInput = argv[++i];
+            options.toneMapOutput = argv[++i];
+        }
+        else if (arg == "--gbuffer" && hasValue) {
+            options.gbufferFile = argv[++i];
+        }
+        else if (arg == "--relight" && hasValue) {
+            options.relightFile = argv[++i];
+        }
+        else if (arg == "--light-cutoff" && hasValue) {
+            options.lightCutoff = atof(argv[++i]);
+        }
+        else if (arg == "--light-samples" && hasValue) {
+            options.lightSamples = atoi(argv[++i]);
+        }
+        else if (arg == "--packet" && hasValue) {
+            options.packetSize = atoi(argv[++i]);
+        }
+        else if (arg == "--sort-rays") {
+            options.sortRays = true;
+        }
+        else if (arg == "--area-samples" && i + 2 < argc) {
+            options.areaSamples = max(atoi(argv[++i]), 1);
+            options.areaMaxSamples = max(atoi(argv[++i]), options.areaSamples);
+        }
+        else if (arg == "--denoise" && hasValue) {
+            options.denoisePasses = atoi(argv[++i]);
+            if (options.denoisePasses < 0 || options.denoisePasses > 10) {
+                cerr << "Denoising takes 0 to 10 passes\n";
+                return false;
+            }
+        }
+        else if (arg == "--frames" && hasValue) {
+            options.frames = atoi(argv[++i]);
+        }
+        else if (arg == "--rebuild-ratio" && hasValue) {
+            options.rebuildRatio = atof(argv[++i]);
+        }
+        else if (arg == "--stats") {
+            options.stats = true;
+        }
+        else if (arg == "--server") {
+            options.server = true;
+        }
+        else if (arg == "--cache" && hasValue) {
+            options.cacheSize = atoi(argv[++i]);
+            if (options.cacheSize < 1) {
+                cerr << "The scene cache needs at least 1 entry\n";
+                return false;
+            }
+        }
+        else if (arg == "--incremental") {
+            options.incremental = true;
+        }
+        else if (arg == "--save-queue" && hasValue) {
+            options.saveQueue = atoi(argv[++i]);
+        }
+        else if (arg == "--workers" && hasValue) {
+            options.workers = atoi(argv[++i]);
+        }
+        else if (arg == "--worker-command" && hasValue) {
+            options.workerCommands.push_back(argv[++i]);
+        }
+        else if (arg == "--worker-timeout" && hasValue) {
+            options.workerTimeout = max((float)atof(argv[++i]), 0.0f);
+        }
+        else if (arg == "--worker") {
+            options.worker = true;
+        }
+        else if (arg.compare(0, 2, "--") != 0 && options.sceneFile.empty()) {
+            options.sceneFile = arg;
+        }
+        else {
+            cerr << "Unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+void PrintUsage(const string& program) {
+    cerr << "Usage: " << program << " scene.test [options]\n"
+         << "       " << program << " --tonemap in.pfm out.png [--tone ...] [--exposure E] [--gamma G]\n"
+         << "       " << program << " --server [--cache N] [options]\n"
+         << "  --order row|morton|hilbert  pixel/tile traversal order (default row)\n"
+         << "  --tile N                    traverse N x N tiles along the order (default 1)\n"
+         << "  --aa N                      adaptive anti-aliasing, N x N samples on edges (default 1: off)\n"
+         << "  --aa-threshold T            neighbor color difference that gets refined (default 0.1)\n"
+         << "  --time-budget-ms T          progressive preview, refine until T ms have passed\n"
+         << "  --band N                    render and stream the PNG N rows at a time (bounded memory)\n"
+         << "  --crop X0 Y0 X1 Y1          trace only the pixels X0..X1-1, Y0..Y1-1 and save them alone\n"
+         << "  --crop-full                 save the crop in a black image of the full size instead\n"
+         << "  --hdr F.pfm                 also write the float framebuffer as PFM\n"
+         << "  --tone clamp|reinhard       tone curve of the PNG (default clamp)\n"
+         << "  --exposure E                exposure in stops before the tone curve (default 0)\n"
+         << "  --gamma G                   gamma of the PNG (default 1)\n"
+         << "  --gbuffer F                 save the first hits of the pixel centers for --relight\n"
+         << "  --relight F                 shade the G-buffer F with the lights of the scene, no camera rays\n"
+         << "  --light-cutoff C            skip lights that can't add more than C to a hit (e.g. 0.002)\n"
+         << "  --light-samples N           shade N lights per hit picked by estimated contribution\n"
+         << "  --packet N                  trace camera rays in N x N packets, 0 ray by ray (default 8)\n"
+         << "  --sort-rays                 trace tiles breadth first, reflected rays sorted by direction and origin\n"
+         << "  --area-samples N M          shadow rays per area light: N, up to M in penumbrae (default 4 64)\n"
+         << "  --denoise N                 N edge-avoiding a-trous passes over the frame before saving (3 is typical)\n"
+         << "  --frames N                  render N frames of the keyframed transforms into numbered files\n"
+         << "  --rebuild-ratio R           rebuild the BVH once refits made it R times as costly (default 1.5)\n"
+         << "  --stats                     print render time, cache misses and shadow cache hits\n"
+         << "  --server                    read render jobs from stdin, one per line:\n"
+         << "                              scene.test [output F] [size W H] [camera ...] [maxdepth N]\n"
+         << "  --cache N                   parsed scenes the server keeps (default 4)\n"
+         << "  --incremental               server: keep the last frame, re-trace only what an edit changed\n"
+         << "  --save-queue N              server, frames: save images on another thread, N at most in memory\n"
+         << "  --workers N                 farm tiles out to N local worker processes\n"
+         << "  --worker-command CMD        also start a worker with this shell command (repeatable),\n"
+         << "                              e.g. \"ssh host raytracer scene.test --worker\"\n"
+         << "  --worker-timeout S          give up on a worker that takes over S seconds for a tile (default 60)\n"
+         << "  --worker                    serve tiles on stdin/stdout for a coordinator\n";
+}
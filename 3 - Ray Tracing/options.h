@@ -0,0 +1,64 @@
+#include <string>
+#include <vector>
+using namespace std;
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+// Command line settings that change how a frame is rendered, not what is in the scene
+struct RenderOptions {
+    string sceneFile;
+    
+    enum Order {rowMajor, morton, hilbert};
+    Order order; // Traversal order of the tiles
+    int tileSize; // Tiles are tileSize x tileSize pixels, 1 means a curve over single pixels
+    
+    int aaSamples; // Adaptive anti-aliasing with aaSamples x aaSamples strata, 1 disables it
+    float aaThreshold; // Channel difference between neighbors that triggers refinement
+
+    int timeBudgetMs; // Progressive preview that stops refining after this many milliseconds, 0 renders the full frame
+
+    int bandHeight; // Render and write the PNG this many rows at a time, 0 keeps the whole image in memory
+
+    int cropX0, cropY0, cropX1, cropY1; // Only the pixels [x0, x1) x [y0, y1) are traced, x1 = 0 traces them all
+    bool cropFull; // Save the crop at its place in a black image of the full size, instead of alone
+
+    string hdrFile; // Float framebuffer written as PFM next to the PNG
+    enum ToneOperator {clampTone, reinhardTone};
+    ToneOperator toneOperator; // Curve from the float colors to the 8 bit PNG
+    float exposure; // In stops, 0 keeps the traced values
+    float gamma;
+    string toneMapInput, toneMapOutput; // --tonemap re-exposes a PFM into a PNG without tracing
+
+    string gbufferFile; // First hits and reflection chains of the pixel centers, for --relight
+    string relightFile; // Shade a saved G-buffer with the lights of the scene instead of tracing
+
+    float lightCutoff; // Skip lights (or groups of the light tree) that can't give more than this at a hit
+    int lightSamples; // Shade this many lights per hit, picked at random by their estimated contribution, 0 for all
+    int packetSize; // Camera rays are traced in packets of packetSize x packetSize, 0 traces them one by one
+    bool sortRays; // Trace tiles depth by depth, reflected rays sorted by direction octant and origin
+    int areaSamples, areaMaxSamples; // Shadow rays per area light and hit, and the most where they disagree
+    int denoisePasses; // A-trous passes over the float frame before it is saved, 0 keeps the traced colors
+
+    int frames; // Frames of the keyframed sequence, 0 renders the scene as it was read
+    float rebuildRatio; // Between frames the BVH is refit, and built again once its cost grew past this ratio
+
+    bool stats; // Print render time, cache counters and shadow occluder cache hits
+
+    bool server; // Keep running and read render jobs from stdin
+    int cacheSize; // Parsed scenes the server keeps in memory
+    bool incremental; // The server re-traces only the pixels an edit of the last scene changed
+    int saveQueue; // The server saves images on another thread, this many at most in memory; 0 saves before the next job
+
+    int workers; // Local worker processes the tiles are farmed out to
+    vector<string> workerCommands; // Shell commands starting remote workers, e.g. "ssh host raytracer scene.test --worker"
+    float workerTimeout; // Seconds a worker has to send back a tile before it is given up, 0 waits forever
+    bool worker; // Trace the tiles asked on stdin and answer on stdout
+    
+    RenderOptions();
+};
+
+// Reads the scene file and the options, returns false on a bad option
+bool ParseOptions(int argc, char* argv[], RenderOptions& options);
+void PrintUsage(const string& program);
+#endif // OPTIONS_H
@@ -0,0 +1,136 @@
+#include "pngstream.h"
+
+static const size_t MAX_STORED_BLOCK = 65535; // LEN of a stored deflate block is 16 bits
+
+static unsigned int crcTable[256];
+static bool crcTableReady = false;
+
+unsigned int UpdateCrc(unsigned int crc, const BYTE* data, size_t size) {
+    if (!crcTableReady) {
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1)? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            crcTable[n] = c;
+        }
+        crcTableReady = true;
+    }
+    for (size_t i = 0; i < size; i++) {
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+void PutBigEndian(BYTE* out, unsigned int value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+PngStreamWriter::PngStreamWriter() : file(NULL), width(0), height(0), rows(0), ok(false), adler(1), wroteHeader(false) {}
+
+PngStreamWriter::~PngStreamWriter() {
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+bool PngStreamWriter::Open(const string& fname, int _width, int _height) {
+    file = fopen(fname.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    width = _width;
+    height = _height;
+    rows = 0;
+    ok = true;
+    adler = 1;
+    wroteHeader = false;
+    block.clear();
+    block.reserve(MAX_STORED_BLOCK);
+
+    const BYTE signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    ok = fwrite(signature, 1, 8, file) == 8;
+
+    BYTE header[13];
+    PutBigEndian(header, width);
+    PutBigEndian(header + 4, height);
+    header[8] = 8; // Bits per channel
+    header[9] = 2; // RGB
+    header[10] = 0; // Deflate
+    header[11] = 0; // Adaptive filtering, every row uses filter 0 (none)
+    header[12] = 0; // Not interlaced
+    WriteChunk("IHDR", header, 13);
+    return ok;
+}
+
+void PngStreamWriter::WriteChunk(const char* type, const BYTE* data, size_t size) {
+    BYTE length[4], crc[4];
+    PutBigEndian(length, size);
+    unsigned int c = UpdateCrc(0xFFFFFFFFu, (const BYTE*)type, 4);
+    c = UpdateCrc(c, data, size);
+    PutBigEndian(crc, c ^ 0xFFFFFFFFu);
+    // IEND has no data, and fwrite must not be given its NULL pointer
+    ok = ok && fwrite(length, 1, 4, file) == 4 && fwrite(type, 1, 4, file) == 4 &&
+        (size == 0 || fwrite(data, 1, size, file) == size) && fwrite(crc, 1, 4, file) == 4;
+}
+
+void PngStreamWriter::FlushBlock(bool final) {
+    vector<BYTE> chunk;
+    chunk.reserve(block.size() + 11);
+    if (!wroteHeader) {
+        chunk.push_back(0x78); // Deflate with a 32K window
+        chunk.push_back(0x01); // No dictionary, check bits
+        wroteHeader = true;
+    }
+    unsigned int len = block.size();
+    chunk.push_back(final? 1 : 0); // BFINAL, BTYPE 00 is a stored block
+    chunk.push_back(len & 0xFF);
+    chunk.push_back(len >> 8);
+    chunk.push_back(~len & 0xFF);
+    chunk.push_back((~len >> 8) & 0xFF);
+    chunk.insert(chunk.end(), block.begin(), block.end());
+    if (final) {
+        BYTE check[4];
+        PutBigEndian(check, adler);
+        chunk.insert(chunk.end(), check, check + 4);
+    }
+    WriteChunk("IDAT", &chunk[0], chunk.size());
+    block.clear();
+}
+
+bool PngStreamWriter::WriteRow(const BYTE* rgb) {
+    if (file == NULL || rows >= height) {
+        return false;
+    }
+    BYTE filter = 0;
+    size_t size = 3 * width;
+    unsigned int a = adler & 0xFFFF, b = adler >> 16;
+    for (size_t i = 0; i <= size; i++) {
+        BYTE value = i == 0? filter : rgb[i - 1];
+        a = (a + value) % 65521;
+        b = (b + a) % 65521;
+        // A full block can only be flushed once more data follows it, the last one must be final
+        if (block.size() == MAX_STORED_BLOCK) {
+            FlushBlock(false);
+        }
+        block.push_back(value);
+    }
+    adler = (b << 16) | a;
+    rows++;
+    return ok;
+}
+
+bool PngStreamWriter::Close() {
+    if (file == NULL) {
+        return false;
+    }
+    bool complete = rows == height;
+    FlushBlock(true);
+    WriteChunk("IEND", NULL, 0);
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+    return ok && complete;
+}
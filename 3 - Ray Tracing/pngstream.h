@@ -0,0 +1,32 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+using namespace std;
+
+#ifndef PNGSTREAM_H
+#define PNGSTREAM_H
+
+typedef unsigned char BYTE;
+
+// Writes an 8 bit RGB PNG one row at a time, top row first. The rows go in stored
+// (uncompressed) deflate blocks, so nothing but the current block is kept in memory
+class PngStreamWriter {
+public:
+    PngStreamWriter();
+    ~PngStreamWriter();
+    bool Open(const string& fname, int _width, int _height);
+    bool WriteRow(const BYTE* rgb); // 3 * width bytes
+    bool Close(); // False when a row is missing or the file could not be written
+
+private:
+    void WriteChunk(const char* type, const BYTE* data, size_t size);
+    void FlushBlock(bool final);
+
+    FILE* file;
+    int width, height, rows;
+    bool ok;
+    unsigned int adler; // Adler-32 of the uncompressed rows, it ends the zlib stream
+    vector<BYTE> block; // Uncompressed bytes of the stored block being filled
+    bool wroteHeader; // The zlib header goes in the first IDAT chunk
+};
+#endif // PNGSTREAM_H
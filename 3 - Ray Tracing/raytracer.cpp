@@ -1,77 +1,230 @@
 #include "raytracer.h"
 #include "stdio.h"
+#include "stats.h"
+#include "rng.h"
 
-Ray RayTracer::RayThruPixel(const Camera& camera, float i, float j, int height, int width) {
-
-    vec3 w = glm::normalize(camera.eye - camera.center);
-    vec3 u = glm::normalize(glm::cross(camera.up, w));
-    vec3 v = glm::cross(w, u);
-        
-    float fovy = camera.fovy * PI / 180.0;
-    float tan_x = tan(fovy / 2.0) * width / height;
-    float beta = tan(fovy / 2.0) * (height/2.0 - i) / (height / 2.0);
-    float alpha =  tan_x * (j - width/2.0) / (width / 2.0);
-
-    return Ray(camera.eye, alpha*u + beta*v - w);
+RayTracer::RayTracer(float _lightCutoff, int _lightSamples, int _packetSize, bool _sortRays, int _areaSamples, int _areaMaxSamples) : 
+    lightCutoff(_lightCutoff), lightSamples(_lightSamples), packetSize(_packetSize), sortRays(_sortRays), areaSamples(_areaSamples), 
+    areaMaxSamples(_areaMaxSamples), shadowRays(0), occluderHits(0), nodeVisits(0), softShadows(0), softShadowSamples(0) {}
 
+RayTracer::~RayTracer() {
+    traceCounters.shadowRays += shadowRays;
+    traceCounters.occluderHits += occluderHits;
+    traceCounters.nodeVisits += nodeVisits;
+    traceCounters.softShadows += softShadows;
+    traceCounters.softShadowSamples += softShadowSamples;
 }
 
 Ray RayTracer::TransformRay(const Ray& ray, const Object* object) {
 
-    vec4 or_extend(ray.origin, 1.0); // vec4 because it turns into homogenous coordinates
-    vec4 dir_extend(ray.direction, 0.0); // The homogenous coordinate w is 0
+    // The transform kind picks the cheapest path, identity objects don't do any matrix work
+	// The direction keeps its homogenous coordinate w = 0 so it is never translated
+    return Ray(object->transform->ToObjectPoint(ray.origin), object->transform->ToObjectDirection(ray.direction));
+
+}
+
+bool RayTracer::IntersectObject(const Ray& ray, const Object* object, float* distance) {
 
-	// We calculate the inverse transform applied to the original ray
-    or_extend = (or_extend * object->InversedTransform);
-    dir_extend = (dir_extend * object->InversedTransform);
+    // Ray in object space
+    Ray transformedRay = TransformRay(ray, object);
+    if (!object->Intersect(transformedRay, distance)) {
+        return false;
+    }
+    // The direction is not renormalized, so for affine transforms the object space t is also the world space t
+    // Only a projective matrix needs the hit point back in world space
+    if (object->transform->kind == ObjectTransform::projective) {
+        vec3 hit = object->transform->ToWorldPoint(transformedRay.origin + transformedRay.direction * *distance);
+        *distance = glm::dot(hit - ray.origin, ray.direction) / glm::dot(ray.direction, ray.direction);
+    }
+    return true;
 
-    // We come back to the actual coordinate system
-	vec3 or = vec3(or_extend.x / or_extend.w, or_extend.y / or_extend.w, or_extend.z / or_extend.w);
-    vec3 dir = vec3(dir_extend.x, dir_extend.y, dir_extend.z);
-    return Ray(or, dir);
+}
 
+void RayTracer::TestObject(const Ray& ray, const Scene& scene, int position, float& best, int& bestPosition) {
+    float t; // Distance
+    if (IntersectObject(ray, scene.objects[position], &t) && (t < best || (t == best && position < bestPosition))) {
+        best = t;
+        bestPosition = position;
+    }
 }
 
-bool RayTracer::GetIntersection(const Ray& ray, const Scene& scene, const Object* &hitObject, vec3* hitPoint) {
+bool RayTracer::GetIntersection(const Ray& ray, const Scene& scene, const Object* &hitObject, vec3* hitPoint, float* distance) {
 
     float mindtist = INF; // INFINITE
-    hitObject = NULL;
+    int minPosition = -1;
+    const ObjectBVH& bvh = scene.bvh;
 
-    for (int i = 0; i < (int)scene.objects.size(); ++i) {
-        // Ray in object space
-        Ray transformedRay = TransformRay(ray, scene.objects[i]);
-        float t; // Distance
-        
-		if (scene.objects[i]->Intersect(transformedRay, &t)) {
-            // Get back the hit point
-            vec3 hit_trans = transformedRay.origin + transformedRay.direction * t; // ray = origin + direction*distance
-            
-			// It turns into homogenous coordinates
-			vec4 hit_extend(hit_trans, 1.0); 
-            hit_extend = hit_extend * scene.objects[i]->transform;
+    for (int i = 0; i < (int)bvh.unbounded.size(); ++i) {
+        TestObject(ray, scene, bvh.unbounded[i], mindtist, minPosition);
+    }
 
-			// We must come back to the actual coordinate system
-            vec3 hit = vec3(hit_extend.x / hit_extend.w, hit_extend.y / hit_extend.w, hit_extend.z / hit_extend.w);
-            
-            t = glm::length(hit - ray.origin); // The norm determines the length of a vector
-            if (t < mindtist) {
-                mindtist = t;
-                hitObject = scene.objects[i];
-                *hitPoint = hit;
+    // Nodes that the ray enters only after the closest hit so far are skipped
+    int stack[64];
+    int top = 0;
+    if (!bvh.nodes.empty()) {
+        stack[top++] = 0;
+    }
+    while (top > 0) {
+        const ObjectBVH::Node& node = bvh.nodes[stack[--top]];
+        nodeVisits++;
+        if (!RayHitsBounds(node.bounds, ray.origin, ray.direction, mindtist)) {
+            continue;
+        }
+        if (node.left < 0) {
+            for (int i = node.first; i < node.first + node.count; ++i) {
+                TestObject(ray, scene, bvh.order[i], mindtist, minPosition);
             }
         }
+        else if (ray.direction[node.axis] < 0) { // The near child is popped first
+            stack[top++] = node.left;
+            stack[top++] = node.right;
+        }
+        else {
+            stack[top++] = node.right;
+            stack[top++] = node.left;
+        }
     }
 
-    if (hitObject == NULL)
+    if (minPosition < 0) {
+        hitObject = NULL;
         return false;
+    }
     else {
+        hitObject = scene.objects[minPosition];
+        // The world hit point is only built for the closest object
+        *hitPoint = ray.origin + ray.direction * mindtist; // ray = origin + direction*distance
+        if (distance != NULL) {
+            *distance = mindtist;
+        }
         return true;
     }
 
 }
 
-Color RayTracer::GetColor(const Ray& ray, const Scene& scene, int depth, float pixH, float pixW) {
+void RayTracer::IntersectPacket(const RayPacket& packet, const Scene& scene, const Object** hitObjects, float* distances) {
+    int count = packet.Size();
+    const ObjectBVH& bvh = scene.bvh;
+    vector<int> positions(count, -1);
+    RayCone cone;
+    for (int k = 0; k < count; ++k) {
+        cone.origins.Grow(packet.OriginAt(k));
+        distances[k] = INF;
+        vec3 direction(packet.dx[k], packet.dy[k], packet.dz[k]);
+        cone.lower = k == 0? direction : glm::min(cone.lower, direction);
+        cone.upper = k == 0? direction : glm::max(cone.upper, direction);
+        for (int i = 0; i < (int)bvh.unbounded.size(); ++i) {
+            TestObject(packet.At(k), scene, bvh.unbounded[i], distances[k], positions[k]);
+        }
+    }
+
+    // A node is skipped for the whole packet when the cone of its directions misses it, or
+    // reaches it only after the farthest closest hit of the rays
+    float farthest = INF;
+    int stack[64];
+    int top = 0;
+    if (!bvh.nodes.empty() && count > 0) {
+        stack[top++] = 0;
+    }
+    while (top > 0) {
+        const ObjectBVH::Node& node = bvh.nodes[stack[--top]];
+        nodeVisits++;
+        if (!ConeHitsBounds(node.bounds, cone, farthest)) {
+            continue;
+        }
+        if (node.left < 0) {
+            farthest = 0;
+            for (int k = 0; k < count; ++k) {
+                Ray ray = packet.At(k);
+                if (RayHitsBounds(node.bounds, ray.origin, ray.direction, distances[k])) {
+                    for (int i = node.first; i < node.first + node.count; ++i) {
+                        TestObject(ray, scene, bvh.order[i], distances[k], positions[k]);
+                    }
+                }
+                farthest = max(farthest, distances[k]);
+            }
+        }
+        else if (cone.upper[node.axis] < 0) { // The near child is popped first
+            stack[top++] = node.left;
+            stack[top++] = node.right;
+        }
+        else {
+            stack[top++] = node.right;
+            stack[top++] = node.left;
+        }
+    }
+    for (int k = 0; k < count; ++k) {
+        hitObjects[k] = positions[k] < 0? NULL : scene.objects[positions[k]];
+    }
+}
+
+bool RayTracer::IsLightVisible(const Light& light, const Scene& scene, const vec3& hitPoint, int lightIndex) {
+
+	shadowRays++;
+	const Object* cached = NULL;
+	if (lightIndex >= 0) {
+		if (lightIndex >= (int)lastOccluder.size()) {
+			lastOccluder.resize(lightIndex + 1, -1);
+		}
+		int position = lastOccluder[lightIndex];
+		if (position >= 0 && position < (int)scene.objects.size()) {
+			cached = scene.objects[position];
+		}
+	}
+
+	const Object* tmpObject;
+	if (light.type == Light::point) { // POINT LIGHT
+		Ray shadowRay(light.position(), hitPoint - light.position());
+
+		// The closest hit can only be nearer, so a cached object well before the point answers alone
+		float cachedT;
+		if (cached != NULL && IntersectObject(shadowRay, cached, &cachedT) && cachedT < 1.0 && !IsSameParameter(shadowRay, cachedT, 1.0)) {
+			occluderHits++;
+			return false;
+		}
+            
+		vec3 shadowHit;
+		float shadowT;
+            
+		bool ok = GetIntersection(shadowRay, scene, tmpObject, &shadowHit, &shadowT);
+
+		// The hit point sits at t = 1 on the shadow ray, the light reaches it when nothing is hit before
+		bool lit = ok && IsSameParameter(shadowRay, shadowT, 1.0);
+		if (!lit && ok && lightIndex >= 0) {
+			lastOccluder[lightIndex] = tmpObject->index - 1;
+		}
+		return lit;
+	} 
+	else { // DIRECTIONAL LIGHT
+		// Returning true serves for all the scenes except scene6
+
+		// Everything that follows serves for all the scenes
+		Ray shadowRay(hitPoint, hitPoint - light.direction());
 
+		// Any hit lights the point, the cached object is enough when it is on the ray
+		float cachedT;
+		if (cached != NULL && IntersectObject(shadowRay, cached, &cachedT)) {
+			occluderHits++;
+			return true;
+		}
+            
+		vec3 shadowHit;
+            
+		bool ok = GetIntersection(shadowRay, scene, tmpObject, &shadowHit);
+		if (ok && lightIndex >= 0) {
+			lastOccluder[lightIndex] = tmpObject->index - 1;
+		}
+
+		// Lit whether or not shadowHit is the hit point itself, for scene5 also changing the value of epsilon
+		return ok;
+	}
+
+}
+
+Color RayTracer::GetColor(const Ray& ray, const Scene& scene, int depth, float pixH, float pixW, const Object** firstHit, PathRecord* record) {
+
+    if (firstHit != NULL) {
+        *firstHit = NULL;
+    }
     if (depth > scene.maxDepth) {
         return BLACK;
     }
@@ -82,93 +235,492 @@ Color RayTracer::GetColor(const Ray& ray, const Scene& scene, int depth, float p
         return BLACK;
 	}
 	else {
-		Color color(hitObject->materials.ambient + hitObject->materials.emission);
-		for (int i = 0; i < (int)scene.lights.size(); ++i) {
-
-			if (scene.lights[i].type == Light::point) { // POINT LIGHT
-				Ray shadowRay(scene.lights[i].position(), hitPoint - scene.lights[i].position());
-            
-				const Object* tmpObject;
-				vec3 shadowHit;
-            
-				bool ok = GetIntersection(shadowRay, scene, tmpObject, &shadowHit);
+		if (firstHit != NULL) {
+			*firstHit = hitObject;
+		}
+		return ShadeHit(ray, scene, depth, pixH, pixW, hitObject, hitPoint, record);
+	}
 
-				if (ok) {
-					if (IsSameVector(hitPoint, shadowHit)) {
-						color = color + CalculateLighting(scene.lights[i], hitObject, ray, hitPoint, scene.attenuation);
-					}
-				}
+}
 
-			} 
-			else { // DIRECTIONAL LIGHT
-				// This lonely line serves for all the scenes except scene6
-				// color = color + CalculateLighting(scene.lights[i], hitObject, ray, hitPoint, scene.attenuation);
+Color RayTracer::ShadeHit(const Ray& ray, const Scene& scene, int depth, float pixH, float pixW, const Object* hitObject, const vec3& hitPoint,
+                          PathRecord* record, const unsigned char* lightVisible) {
 
-				// Everything that follows serves for all the scenes
-				Ray shadowRay(hitPoint, hitPoint - scene.lights[i].direction());
-            
-				const Object* tmpObject;
-				vec3 shadowHit;
-            
-				bool ok = GetIntersection(shadowRay, scene, tmpObject, &shadowHit);
-
-				if (ok) {
-					if (IsSameVector(hitPoint, shadowHit)) {
-						color = color + CalculateLighting(scene.lights[i], hitObject, ray, hitPoint, scene.attenuation);
-					}
-					else { // For scene5 also changing the value of epsilon
-						color = color + CalculateLighting(scene.lights[i], hitObject, ray, hitPoint, scene.attenuation);
-					}
-				}
-				
-			}
-		}
+		const Materials& materials = scene.GetMaterials(hitObject);
+		Color color = ShadeDirect(ray, scene, depth, pixH, pixW, hitObject, hitPoint, record, lightVisible);
     
-		if (!hitObject->materials.specular.isZero()) {
+		if (!materials.specular.isZero()) {
 			vec3 unitNormal = glm::normalize( hitObject->InterpolatePointNormal(hitPoint) );
 			Ray reflectedRay = GenerateReflectedRay(ray, hitPoint, unitNormal);
         
 			// Recursive call to trace the reflected ray
-			Color tempColor = GetColor(reflectedRay, scene, depth+1, pixH, pixW); // depth+1 until reach the maximum
-			color = color + hitObject->materials.specular * tempColor;
+			Color tempColor = GetColor(reflectedRay, scene, depth+1, pixH, pixW, NULL, record); // depth+1 until reach the maximum
+			color = color + materials.specular * tempColor;
 		}
 
 		return color;
-	}
 
 }
 
-Ray RayTracer::GenerateReflectedRay(const Ray& ray, const vec3& hit, const vec3& unitNormal) {
-    vec3 p1 = ray.direction - (unitNormal * (2 * glm::dot(ray.direction, unitNormal)));
-    return Ray(hit, p1);
+Color RayTracer::ShadeDirect(const Ray& ray, const Scene& scene, int depth, float pixH, float pixW, const Object* hitObject, const vec3& hitPoint,
+                             PathRecord* record, const unsigned char* lightVisible) {
+
+		const Materials& materials = scene.GetMaterials(hitObject);
+		Color color(materials.ambient + materials.emission);
+		int vertexIndex = -1;
+		if (record != NULL) {
+			PathVertex vertex;
+			vertex.position = hitPoint;
+			vertex.normal = glm::normalize(hitObject->InterpolatePointNormal(hitPoint));
+			vertex.viewDirection = ray.direction;
+			vertex.objectIndex = hitObject->index;
+			vertex.materialId = hitObject->materialId;
+			vertex.visibleLights = 0;
+			record->push_back(vertex);
+			vertexIndex = record->size() - 1; // The recursion of ShadeHit may move the vertices
+		}
+
+		// The G-buffer shades every light, relighting has no estimator weights
+		SelectLights(scene, hitPoint, materials, record != NULL, pixH, pixW, depth);
+		int kept = 0;
+		areaLights.clear();
+		areaLightWeights.clear();
+		for (int s = 0; s < (int)selectedLights.size(); ++s) {
+			int i = selectedLights[s];
+			if (scene.lights[i].IsAreaLight()) { // Soft shadows, sampled below
+				areaLights.push_back(i);
+				areaLightWeights.push_back(lightWeights[s]);
+				continue;
+			}
+			bool visible = lightVisible != NULL? lightVisible[i] != 0 : IsLightVisible(scene.lights[i], scene, hitPoint, i);
+			if (visible) {
+				selectedLights[kept] = i;
+				lightWeights[kept++] = lightWeights[s];
+				if (vertexIndex >= 0 && i < 64) {
+					(*record)[vertexIndex].visibleLights |= 1ULL << i;
+				}
+			}
+		}
+		if (kept == 0 && areaLights.empty()) {
+			return color;
+		}
+		ShadingPoint point(hitPoint, glm::normalize(hitObject->InterpolatePointNormal(hitPoint)), ray.direction, materials);
+		if (kept > 0) {
+			color = ShadeLights(point, scene.lights, &selectedLights[0], &lightWeights[0], kept, scene.attenuation, color);
+		}
+		for (int a = 0; a < (int)areaLights.size(); ++a) {
+			color = ShadeAreaLight(scene, areaLights[a], point, areaLightWeights[a], pixH, pixW, depth, color);
+		}
+		return color;
+
 }
 
-Color RayTracer::CalculateLighting(const Light& light, const Object* hitObject, const Ray& ray, const vec3& hitPoint, const float* attenuation) {
+// Random streams of the area light samples, apart from those of light sampling
+static const unsigned int AREA_LIGHT_SEED = 1;
 
-    vec3 lightDirection;
-    if (light.type == Light::point) { // POINT LIGHT
-        lightDirection = glm::normalize(light.position() - hitPoint);
-    } 
-	else { // DIRECTIONAL LIGHT
-        lightDirection = glm::normalize(light.direction());
-	}
-    
-    vec3 normal = glm::normalize(hitObject->InterpolatePointNormal(hitPoint));
-    
-    const Materials& materials = hitObject->materials;
-    float nDotL = max(glm::dot(normal, lightDirection), 0.0f);
-    Color diffuse = materials.diffuse * light.color * nDotL;
-    
-    vec3 halfvec = glm::normalize(lightDirection + glm::normalize(-ray.direction));
-    float nDotH = max(glm::dot(normal, halfvec), 0.0f);
-    Color specular = materials.specular * light.color * pow(nDotH, materials.shininess);
-        
-    Color result = diffuse + specular;
-    if (light.type == Light::point) { // POINT LIGHT
-        float d = glm::length(light.position() - hitPoint);
-        result = result * (1.0 / (attenuation[0] + attenuation[1] * d + attenuation[2] * pow(d, 2)));
+Color RayTracer::ShadeAreaLight(const Scene& scene, int lightIndex, const ShadingPoint& point, float weight, float pixH, float pixW, int depth, Color color) {
+    const Light& light = scene.lights[lightIndex];
+    RandomStream random = RandomStream::ForImagePoint(pixH, pixW, depth, AREA_LIGHT_SEED);
+    unsigned int scramble[2] = {random.UInt(2*lightIndex), random.UInt(2*lightIndex + 1)};
+
+    // A sphere light is sampled on the disk it shows to the point, axes as long as the radius
+    vec3 axisU = light.edgeU, axisV = light.edgeV;
+    if (light.type == Light::sphere) {
+        vec3 w = glm::normalize(point.position - light.position());
+        vec3 helper = fabs(w.x) > 0.5f? vec3(0, 1, 0) : vec3(1, 0, 0);
+        axisU = glm::normalize(glm::cross(helper, w)) * light.radius;
+        axisV = glm::cross(w, axisU);
     }
 
-    return result;
+    // Rounds of Sobol points double until they all agree or the maximum is reached, so only
+    // the penumbra pays for many shadow rays. Each visible point shades like a point light
+    areaPoints.clear();
+    int taken = 0;
+    int target = max(min(areaSamples, areaMaxSamples), 1);
+    while (true) {
+        for ( ; taken < target; ++taken) {
+            float u[2];
+            Sobol2D(taken, scramble, u);
+            Light sample = light;
+            sample.type = Light::point;
+            if (light.type == Light::quad) {
+                sample.position_direction = light.position() + axisU * (u[0] - 0.5f) + axisV * (u[1] - 0.5f);
+            }
+            else {
+                float r = sqrt(u[0]), phi = 2 * PI * u[1];
+                sample.position_direction = light.position() + axisU * (r * cos(phi)) + axisV * (r * sin(phi));
+            }
+            if (IsLightVisible(sample, scene, point.position, lightIndex)) {
+                areaPoints.push_back(sample);
+            }
+        }
+        int lit = areaPoints.size();
+        if (lit == 0 || lit == taken || taken >= areaMaxSamples) {
+            break;
+        }
+        target = min(2 * target, areaMaxSamples);
+    }
+    softShadows++;
+    softShadowSamples += taken;
+
+    int lit = areaPoints.size();
+    if (lit == 0) {
+        return color;
+    }
+    areaIndices.resize(lit);
+    for (int k = 0; k < lit; ++k) {
+        areaIndices[k] = k;
+    }
+    areaWeights.assign(lit, weight / taken);
+    return ShadeLights(point, areaPoints, &areaIndices[0], &areaWeights[0], lit, scene.attenuation, color);
+}
+
+bool RayTracer::PacketHits(const RayPacket& packet, const Scene& scene, const Object** hitObjects, vec3* hitPoints, vector<unsigned char>& lightVisible) {
+    int count = packet.Size();
+    vector<float> distances(count);
+    IntersectPacket(packet, scene, hitObjects, &distances[0]);
+
+    vector<int> hits; // Rays that hit something
+    for (int k = 0; k < count; ++k) {
+        if (hitObjects[k] != NULL) {
+            Ray ray = packet.At(k);
+            hitPoints[k] = ray.origin + ray.direction * distances[k];
+            hits.push_back(k);
+        }
+    }
+
+    // The shadow rays of a point light all start on the light, so they make a packet too. With a
+    // cutoff or light sampling each hit shades its own lights and casts its own shadow rays
+    int lights = scene.lights.size();
+    bool packetShadows = lightCutoff <= 0 && lightSamples <= 0 && !hits.empty();
+    lightVisible.assign(packetShadows? count * lights : 0, 0);
+    for (int i = 0; i < lights && packetShadows; ++i) {
+        const Light& light = scene.lights[i];
+        if (light.IsAreaLight()) { // ShadeDirect samples its soft shadow
+            continue;
+        }
+        if (light.type != Light::point) {
+            for (int h = 0; h < (int)hits.size(); ++h) {
+                lightVisible[hits[h] * lights + i] = IsLightVisible(light, scene, hitPoints[hits[h]], i);
+            }
+            continue;
+        }
+        RayPacket shadows;
+        shadows.origin = light.position();
+        for (int h = 0; h < (int)hits.size(); ++h) {
+            vec3 direction = hitPoints[hits[h]] - light.position();
+            shadows.dx.push_back(direction.x);
+            shadows.dy.push_back(direction.y);
+            shadows.dz.push_back(direction.z);
+        }
+        vector<const Object*> occluders(hits.size());
+        vector<float> shadowT(hits.size());
+        IntersectPacket(shadows, scene, &occluders[0], &shadowT[0]);
+        shadowRays += hits.size();
+        // Same test as IsLightVisible: the hit point itself must be the first thing on the shadow ray
+        for (int h = 0; h < (int)hits.size(); ++h) {
+            lightVisible[hits[h] * lights + i] = occluders[h] != NULL && IsSameParameter(shadows.At(h), shadowT[h], 1.0);
+        }
+    }
+    return packetShadows;
+}
+
+void RayTracer::TracePacket(const RayPacket& packet, const Scene& scene, Color* colors, int* objectIds) {
+    int count = packet.Size();
+    if (scene.maxDepth < 0) {
+        for (int k = 0; k < count; ++k) {
+            colors[k] = BLACK;
+            objectIds[k] = 0;
+        }
+        return;
+    }
+    vector<const Object*> hitObjects(count);
+    vector<vec3> hitPoints(count);
+    vector<unsigned char> lightVisible;
+    // Without lights there is no shadow test to hand over, and lightVisible is empty
+    int lights = scene.lights.size();
+    bool packetShadows = PacketHits(packet, scene, &hitObjects[0], &hitPoints[0], lightVisible) && lights > 0;
+    for (int k = 0; k < count; ++k) {
+        if (hitObjects[k] == NULL) {
+            colors[k] = BLACK;
+            objectIds[k] = 0;
+            continue;
+        }
+        colors[k] = ShadeHit(packet.At(k), scene, 0, packet.i[k], packet.j[k], hitObjects[k], hitPoints[k], NULL, 
+            packetShadows? &lightVisible[k * lights] : NULL);
+        objectIds[k] = hitObjects[k]->index;
+    }
+}
+
+// Spreads the low 10 bits of v to every third bit
+static unsigned int SpreadBits(unsigned int v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+struct CompareKeys {
+    const vector<unsigned long long>* keys;
+    bool operator()(int a, int b) const { return (*keys)[a] < (*keys)[b]; }
+};
+
+// Puts the rays of the wave in order of direction octant, then of the Morton code of their origin
+// within the bounds of all the origins, so that consecutive rays leave close points the same way
+static void SortWave(RayPacket& wave, vector<int>& pixels) {
+    int count = wave.Size();
+    Bounds origins;
+    for (int k = 0; k < count; ++k) {
+        origins.Grow(wave.OriginAt(k));
+    }
+    vec3 size = origins.upper - origins.lower;
+    vector<unsigned long long> keys(count);
+    vector<int> order(count);
+    for (int k = 0; k < count; ++k) {
+        vec3 cell = wave.OriginAt(k) - origins.lower;
+        unsigned int code = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            unsigned int q = size[axis] > 0? (unsigned int)min(cell[axis] / size[axis] * 1023.0f, 1023.0f) : 0;
+            code |= SpreadBits(q) << axis;
+        }
+        unsigned int octant = (wave.dx[k] < 0? 1 : 0) | (wave.dy[k] < 0? 2 : 0) | (wave.dz[k] < 0? 4 : 0);
+        keys[k] = ((unsigned long long)octant << 30) | code;
+        order[k] = k;
+    }
+    CompareKeys compare = {&keys};
+    sort(order.begin(), order.end(), compare);
+
+    RayPacket sorted;
+    sorted.ox.resize(count); sorted.oy.resize(count); sorted.oz.resize(count);
+    sorted.dx.resize(count); sorted.dy.resize(count); sorted.dz.resize(count);
+    sorted.i.resize(count); sorted.j.resize(count);
+    vector<int> sortedPixels(count);
+    for (int k = 0; k < count; ++k) {
+        int from = order[k];
+        sorted.ox[k] = wave.ox[from]; sorted.oy[k] = wave.oy[from]; sorted.oz[k] = wave.oz[from];
+        sorted.dx[k] = wave.dx[from]; sorted.dy[k] = wave.dy[from]; sorted.dz[k] = wave.dz[from];
+        sorted.i[k] = wave.i[from]; sorted.j[k] = wave.j[from];
+        sortedPixels[k] = pixels[from];
+    }
+    wave = sorted;
+    pixels.swap(sortedPixels);
+}
+
+// Rays [first, first+count) of the wave as a packet of their own
+static void SlicePacket(const RayPacket& wave, int first, int count, RayPacket& packet) {
+    packet.origin = wave.origin;
+    if (wave.ox.empty()) {
+        packet.ox.clear(); packet.oy.clear(); packet.oz.clear();
+    }
+    else {
+        packet.ox.assign(wave.ox.begin() + first, wave.ox.begin() + first + count);
+        packet.oy.assign(wave.oy.begin() + first, wave.oy.begin() + first + count);
+        packet.oz.assign(wave.oz.begin() + first, wave.oz.begin() + first + count);
+    }
+    packet.dx.assign(wave.dx.begin() + first, wave.dx.begin() + first + count);
+    packet.dy.assign(wave.dy.begin() + first, wave.dy.begin() + first + count);
+    packet.dz.assign(wave.dz.begin() + first, wave.dz.begin() + first + count);
+    packet.i.assign(wave.i.begin() + first, wave.i.begin() + first + count);
+    packet.j.assign(wave.j.begin() + first, wave.j.begin() + first + count);
+}
+
+// Widest spread a packet of reflected rays keeps: of its unit directions on any axis, and of its origins
+// against the size of the scene. Off curved surfaces sorted rays still fan out, and a wide packet reaches
+// many leaves whose box is then tested for every ray, far more work than tracing the rays one by one
+static const float MAX_DIRECTION_SPREAD = 0.25;
+static const float MAX_ORIGIN_SPREAD = 0.05;
+
+static bool IsCoherent(const RayPacket& packet, const Scene& scene) {
+    if (scene.bvh.nodes.empty()) {
+        return true;
+    }
+    Bounds origins, directions;
+    for (int k = 0; k < packet.Size(); ++k) {
+        origins.Grow(packet.OriginAt(k));
+        directions.Grow(glm::normalize(vec3(packet.dx[k], packet.dy[k], packet.dz[k])));
+    }
+    vec3 spread = directions.upper - directions.lower;
+    vec3 extent = origins.upper - origins.lower;
+    vec3 size = scene.bvh.nodes[0].bounds.upper - scene.bvh.nodes[0].bounds.lower;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (spread[axis] > MAX_DIRECTION_SPREAD || extent[axis] > MAX_ORIGIN_SPREAD * max(size.x, max(size.y, size.z))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RayTracer::TraceWaves(const RayPacket& cameraRays, const Scene& scene, Color* colors, int* objectIds) {
+    int pixelCount = cameraRays.Size();
+    int packetRays = max(packetSize * packetSize, 1);
+    RayPacket wave = cameraRays, next, packet;
+    vector<int> pixels(pixelCount), nextPixels;
+    for (int k = 0; k < pixelCount; ++k) {
+        pixels[k] = k;
+        objectIds[k] = 0;
+    }
+
+    // Direct light and specular color of every hit, wave by wave, to add up once the last wave is done
+    vector<vector<int> > hitPixels;
+    vector<vector<Color> > direct, specular;
+    vector<const Object*> hitObjects(packetRays);
+    vector<vec3> hitPoints(packetRays);
+    vector<unsigned char> lightVisible;
+    for (int depth = 0; depth <= scene.maxDepth && wave.Size() > 0; ++depth) {
+        if (depth > 0) {
+            SortWave(wave, pixels);
+        }
+        hitPixels.push_back(vector<int>());
+        direct.push_back(vector<Color>());
+        specular.push_back(vector<Color>());
+        next = RayPacket();
+        nextPixels.clear();
+        int lights = scene.lights.size();
+        for (int first = 0; first < wave.Size(); first += packetRays) {
+            int count = min(packetRays, wave.Size() - first);
+            bool packetShadows = false;
+            if (packetSize > 0) {
+                SlicePacket(wave, first, count, packet);
+            }
+            if (packetSize > 0 && (depth == 0 || IsCoherent(packet, scene))) {
+                // Without lights lightVisible is empty, there is nothing to hand over
+                packetShadows = PacketHits(packet, scene, &hitObjects[0], &hitPoints[0], lightVisible) && lights > 0;
+            }
+            else {
+                for (int k = 0; k < count; ++k) {
+                    GetIntersection(wave.At(first + k), scene, hitObjects[k], &hitPoints[k]);
+                }
+            }
+
+            for (int k = 0; k < count; ++k) {
+                if (hitObjects[k] == NULL) {
+                    continue;
+                }
+                int r = first + k;
+                Ray ray = wave.At(r);
+                const Materials& materials = scene.GetMaterials(hitObjects[k]);
+                hitPixels.back().push_back(pixels[r]);
+                direct.back().push_back(ShadeDirect(ray, scene, depth, wave.i[r], wave.j[r], hitObjects[k], hitPoints[k], NULL,
+                    packetShadows? &lightVisible[k * lights] : NULL));
+                specular.back().push_back(materials.specular);
+                if (depth == 0) {
+                    objectIds[pixels[r]] = hitObjects[k]->index;
+                }
+                if (materials.specular.isZero() || depth == scene.maxDepth) {
+                    continue;
+                }
+                vec3 unitNormal = glm::normalize(hitObjects[k]->InterpolatePointNormal(hitPoints[k]));
+                Ray reflectedRay = GenerateReflectedRay(ray, hitPoints[k], unitNormal);
+                next.ox.push_back(reflectedRay.origin.x);
+                next.oy.push_back(reflectedRay.origin.y);
+                next.oz.push_back(reflectedRay.origin.z);
+                next.dx.push_back(reflectedRay.direction.x);
+                next.dy.push_back(reflectedRay.direction.y);
+                next.dz.push_back(reflectedRay.direction.z);
+                next.i.push_back(wave.i[r]);
+                next.j.push_back(wave.j[r]);
+                nextPixels.push_back(pixels[r]);
+            }
+        }
+        wave = next;
+        pixels.swap(nextPixels);
+    }
+
+    // Deepest wave first, color = direct + specular * (color of the reflection) as in ShadeHit. A pixel
+    // whose reflection missed still holds BLACK from the start
+    for (int k = 0; k < pixelCount; ++k) {
+        colors[k] = BLACK;
+    }
+    for (int depth = hitPixels.size() - 1; depth >= 0; --depth) {
+        for (int h = 0; h < (int)hitPixels[depth].size(); ++h) {
+            Color& color = colors[hitPixels[depth][h]];
+            if (specular[depth][h].isZero()) {
+                color = direct[depth][h];
+            }
+            else {
+                color = direct[depth][h] + specular[depth][h] * color;
+            }
+        }
+    }
+}
 
+void RayTracer::SelectLights(const Scene& scene, const vec3& hitPoint, const Materials& materials, bool all, float i, float j, int depth) {
+    int count = scene.lights.size();
+    if (all || (lightCutoff <= 0 && lightSamples <= 0)) {
+        selectedLights.resize(count);
+        for (int k = 0; k < count; ++k) {
+            selectedLights[k] = k;
+        }
+        lightWeights.assign(count, 1.0);
+        return;
+    }
+
+    if (lightCutoff > 0) {
+        // n.l and (n.h)^s are at most 1, so the material reflects at most this much of a light
+        const Color& d = materials.diffuse;
+        const Color& s = materials.specular;
+        float scale = max(d.r, max(d.g, d.b)) + max(s.r, max(s.g, s.b));
+        scene.lightTree.Collect(hitPoint, scene.attenuation, lightCutoff, scale, selectedLights);
+    }
+    else {
+        selectedLights.resize(count);
+        for (int k = 0; k < count; ++k) {
+            selectedLights[k] = k;
+        }
+    }
+    int candidates = selectedLights.size();
+    lightWeights.assign(candidates, 1.0);
+    if (lightSamples <= 0 || candidates <= lightSamples) {
+        return;
+    }
+
+    // Unshadowed estimate of each candidate, its chance of being picked
+    lightEstimates.resize(candidates);
+    float total = 0;
+    for (int k = 0; k < candidates; ++k) {
+        const Light& light = scene.lights[selectedLights[k]];
+        float estimate = LightIntensity(light);
+        if (light.type != Light::directional) {
+            estimate /= AttenuationAt(scene.attenuation, glm::length(light.position() - hitPoint));
+        }
+        lightEstimates[k] = estimate;
+        total += estimate;
+    }
+    if (total <= 0) {
+        return;
+    }
+
+    // Picks with replacement, a light picked twice counts twice. Weight 1 / (samples * probability) keeps the sum unbiased
+    // The numbers only depend on the sample and the depth, a pixel picks the same lights on every run
+    lightWeights.assign(candidates, 0.0);
+    lightRandom.resize(lightSamples);
+    RandomStream::ForImagePoint(i, j, depth).Floats(0, lightSamples, &lightRandom[0]);
+    for (int n = 0; n < lightSamples; ++n) {
+        float u = lightRandom[n] * total;
+        int k = 0;
+        while (k < candidates - 1 && u >= lightEstimates[k]) {
+            u -= lightEstimates[k];
+            k++;
+        }
+        if (lightEstimates[k] > 0) { // A black light gives nothing either way
+            lightWeights[k] += total / (lightSamples * lightEstimates[k]);
+        }
+    }
+    int kept = 0;
+    for (int k = 0; k < candidates; ++k) {
+        if (lightWeights[k] > 0) {
+            selectedLights[kept] = selectedLights[k];
+            lightWeights[kept] = lightWeights[k];
+            kept++;
+        }
+    }
+    selectedLights.resize(kept);
+    lightWeights.resize(kept);
+}
+
+Ray RayTracer::GenerateReflectedRay(const Ray& ray, const vec3& hit, const vec3& unitNormal) {
+    vec3 p1 = ray.direction - (unitNormal * (2 * glm::dot(ray.direction, unitNormal)));
+    return Ray(hit, p1);
 }
\ No newline at end of file
@@ -1,20 +1,93 @@
-#include "scene.h"
+#include "camerarays.h"
+#include "shading.h"
 #ifndef RAYTRACER_H
 #define RAYTRACER_H
 
 
+// One hit along the reflection chain of a primary ray, what relighting needs to redo the shading.
+// Each vertex adds its specular color times the colors of the vertices after it
+struct PathVertex {
+    vec3 position;
+    vec3 normal; // Unit normal at the hit
+    vec3 viewDirection; // Direction of the ray that found the hit
+    int objectIndex; // Object::index
+    MaterialId materialId;
+    unsigned long long visibleLights; // Bit i is set when light i lit the point, for the first 64 lights
+};
+typedef vector<PathVertex> PathRecord;
+
 class RayTracer {
 public:
-	Ray RayThruPixel(const Camera& camera, float i, float j, int height, int width);
+    RayTracer(float _lightCutoff = 0.0, int _lightSamples = 0, int _packetSize = 8, bool _sortRays = false, int _areaSamples = 4, int _areaMaxSamples = 64);
+    ~RayTracer();
+    float lightCutoff; // Lights (or light tree nodes) that can't give more than this at a hit are skipped, 0 keeps all
+    int lightSamples; // Lights picked at random per hit, in proportion to their unshadowed estimate, 0 shades all
+    int packetSize; // Tiles are traced in packets of packetSize x packetSize camera rays, 0 traces ray by ray
+    bool sortRays; // Tiles are traced breadth first with TraceWaves
+    int areaSamples, areaMaxSamples; // Shadow rays per area light and hit: first round, and most when they disagree
+
+    // firstHit gets the object seen by this ray, NULL for the background. The record gets a vertex per hit
+    Color GetColor(const Ray& ray, const Scene& scene, int depth, float i, float j, const Object** firstHit = NULL, PathRecord* record = NULL);
+
+    // Shading of a hit found by the caller. lightVisible, when given, holds the shadow test of every light
+    Color ShadeHit(const Ray& ray, const Scene& scene, int depth, float i, float j, const Object* hitObject, const vec3& hitPoint,
+                   PathRecord* record = NULL, const unsigned char* lightVisible = NULL);
+    // The part of ShadeHit before the reflection: emission, ambient and the lights
+    Color ShadeDirect(const Ray& ray, const Scene& scene, int depth, float i, float j, const Object* hitObject, const vec3& hitPoint,
+                      PathRecord* record = NULL, const unsigned char* lightVisible = NULL);
 
-    Color GetColor(const Ray& ray, const Scene& scene, int depth, float i, float j);   
+    // Camera rays of a packet: the closest hits and the point light shadows are found for the whole packet,
+    // culling the BVH nodes none of its rays can reach. Same colors as GetColor ray by ray
+    void TracePacket(const RayPacket& packet, const Scene& scene, Color* colors, int* objectIds);
+
+    // Camera rays of a tile traced breadth first: all the hits of a depth are shaded before the next one,
+    // and their reflected rays are sorted by direction octant and origin (Morton order), then traced in
+    // packets of packetSize x packetSize, or ray by ray when a packet spreads too wide. Same colors as
+    // GetColor ray by ray
+    void TraceWaves(const RayPacket& cameraRays, const Scene& scene, Color* colors, int* objectIds);
+
+    // Closest hit of every ray of the packet, NULL and INF when it misses
+    void IntersectPacket(const RayPacket& packet, const Scene& scene, const Object** hitObjects, float* distances);
+
+    // Shadow ray test, true when the light reaches the point. With the light index the object that
+    // answered the last test of that light is tried first, before all the objects
+    bool IsLightVisible(const Light& light, const Scene& scene, const vec3& hitPoint, int lightIndex = -1);
        
-    bool GetIntersection(const Ray& ray, const Scene& scene, const Object* &hitObject, vec3* hitPoint);
-                 
-    Color CalculateLighting(const Light& light, const Object* hitObject, const Ray& ray, const vec3& hitPoint, const float* attenuation);
-    
+    bool IntersectObject(const Ray& ray, const Object* object, float* distance); // World space t of a single object
+    bool GetIntersection(const Ray& ray, const Scene& scene, const Object* &hitObject, vec3* hitPoint, float* distance = NULL); // distance is the parametric t along ray.direction
+
+
     Ray TransformRay(const Ray& ray, const Object* object);
     
     Ray GenerateReflectedRay(const Ray& ray, const vec3& hit, const vec3& unitNormal);
+
+    // color + weight * the light of an area light, its visibility sampled with Sobol points scrambled per
+    // sample and depth: areaSamples first, doubled up to areaMaxSamples while some are lit and some not
+    Color ShadeAreaLight(const Scene& scene, int lightIndex, const ShadingPoint& point, float weight, float i, float j, int depth, Color color);
+
+    // Fills selectedLights and their estimator weights in lightWeights, every light with weight 1
+    // when there is no cutoff and no sampling (or all is set)
+    void SelectLights(const Scene& scene, const vec3& hitPoint, const Materials& materials, bool all, float i, float j, int depth);
+
+private:
+    // Scratch space of SelectLights, used up before GetColor recurses
+    vector<int> selectedLights;
+    vector<float> lightWeights, lightEstimates, lightRandom;
+    // Scratch space of ShadeDirect and ShadeAreaLight
+    vector<int> areaLights, areaIndices;
+    vector<float> areaLightWeights, areaWeights;
+    vector<Light> areaPoints; // Visible samples of an area light, as point lights
+
+    // Per light, the position in Scene::objects of the last object the shadow ray found, -1 for none.
+    // An index can't dangle when the scene changes, a wrong guess only costs one intersection
+    vector<int> lastOccluder;
+
+    // Closest hits of a packet and their points. When every light is shaded, the shadow tests of the
+    // hits go in lightVisible (light i of ray k at k * lights + i) and it returns true
+    bool PacketHits(const RayPacket& packet, const Scene& scene, const Object** hitObjects, vec3* hitPoints, vector<unsigned char>& lightVisible);
+    long long shadowRays, occluderHits, nodeVisits, softShadows, softShadowSamples;
+
+    // Closest hit so far of a BVH traversal, equal distances keep the first object of Scene::objects like a plain loop
+    void TestObject(const Ray& ray, const Scene& scene, int position, float& best, int& bestPosition);
 };
 #endif // RAYTRACER_H
\ No newline at end of file
@@ -0,0 +1,460 @@
+#include <iostream>
+#include <algorithm>
+#include <FreeImage.h>
+#include "render.h"
+#include "distributed.h"
+#include "pngstream.h"
+#include "tonemap.h"
+#include "gbuffer.h"
+#include "denoise.h"
+#include "savequeue.h"
+
+void SaveScreenshot(string fname, BYTE* image, int width, int height) {
+        
+        FIBITMAP* img = FreeImage_ConvertFromRawBits(image, width, height, width * 3, 24, 0xFF0000, 0x00FF00, 0x0000FF, false);
+        
+        std::cout << "Saving screenshot: " << fname << "\n";
+
+        FreeImage_Save(FIF_PNG, img, fname.c_str(), 0);
+        FreeImage_Unload(img);
+}
+
+Tile CropWindow(const RenderOptions& options, int width, int height) {
+    Tile whole(0, 0, width, height);
+    if (options.cropX1 == 0 || !options.gbufferFile.empty()) {
+        return whole;
+    }
+    Tile crop(min(options.cropX0, width), min(options.cropY0, height), min(options.cropX1, width), min(options.cropY1, height));
+    return crop.x0 == crop.x1 || crop.y0 == crop.y1? whole : crop;
+}
+
+// Size of the saved image and the image pixel of its top left corner
+static Tile OutputArea(const RenderOptions& options, const Tile& crop, int width, int height) {
+    return options.cropFull? Tile(0, 0, width, height) : crop;
+}
+
+static bool SameArea(const FrameBuffer& frame, const Tile& area) {
+    return frame.originX == area.x0 && frame.originY == area.y0 && frame.width == area.x1 - area.x0 && frame.height == area.y1 - area.y0;
+}
+
+// Fills out, whose pixels are those of the output area (out.originY is the output row of its first
+// row), with the crop window of the traced frame. Pixels outside the window are black
+static void CopyCrop(const FrameBuffer& frame, const Tile& crop, const Tile& output, FrameBuffer& out) {
+    for (int y = 0 ; y < out.height ; y++) {
+        int iy = output.y0 + out.originY + y; // Image row
+        for (int x = 0 ; x < out.width ; x++) {
+            int ix = output.x0 + x;
+            bool inside = ix >= crop.x0 && ix < crop.x1 && iy >= crop.y0 && iy < crop.y1;
+            out.ColorAt(x, y) = inside? frame.ColorAt(ix - frame.originX, iy - frame.originY) : Color();
+            out.ObjectAt(x, y) = inside? frame.ObjectAt(ix - frame.originX, iy - frame.originY) : 0;
+        }
+    }
+}
+
+void SaveFrame(const FrameBuffer& frame, const RenderOptions& options, const string& fname, SaveQueue* queue) {
+    if (!options.hdrFile.empty() && !WritePfm(options.hdrFile, frame)) {
+        cerr << "Writing " << options.hdrFile << " failed!" << endl;
+    }
+    BYTE* image = new BYTE[3 * frame.width * frame.height];
+    for (int y = 0; y < frame.height; y++) {
+        ToneMapRow(&frame.ColorAt(0, y), frame.width, options, image + 3 * (frame.height-y-1) * frame.width, true);
+    }
+    if (queue != NULL) {
+        queue->Push(fname, image, frame.width, frame.height);
+        return;
+    }
+    SaveScreenshot(fname, image, frame.width, frame.height);
+    delete[] image;
+}
+
+FrameBuffer::FrameBuffer(int _width, int _height, int _originX, int _originY) : width(_width), height(_height), originX(_originX), originY(_originY), 
+    colors(_width * _height), objectIds(_width * _height, 0) {}
+
+Color TraceSample(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, float i, float j, int* objectId) {
+    Ray ray = rays.RayThrough(i, j);
+    const Object* hitObject;
+    Color color = ray_tracer.GetColor(ray, scene, 0, i, j, &hitObject);
+    if (objectId != NULL) {
+        *objectId = hitObject == NULL? 0 : hitObject->index;
+    }
+    return color;
+}
+
+// Camera rays of the whole tile in one wave, packet after packet so that TraceWaves cuts square packets
+static void TraceTileWaves(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, const Tile& tile, FrameBuffer& frame) {
+    int size = ray_tracer.packetSize > 0? ray_tracer.packetSize : max(tile.x1 - tile.x0, 1);
+    RayPacket wave, packet;
+    vector<int> xs, ys;
+    for (int py = tile.y0 ; py < tile.y1 ; py += size) {
+        for (int px = tile.x0 ; px < tile.x1 ; px += size) {
+            Tile part(px, py, min(px + size, tile.x1), min(py + size, tile.y1));
+            rays.TileRays(part, 0.5, 0.5, packet);
+            wave.origin = packet.origin;
+            wave.dx.insert(wave.dx.end(), packet.dx.begin(), packet.dx.end());
+            wave.dy.insert(wave.dy.end(), packet.dy.begin(), packet.dy.end());
+            wave.dz.insert(wave.dz.end(), packet.dz.begin(), packet.dz.end());
+            wave.i.insert(wave.i.end(), packet.i.begin(), packet.i.end());
+            wave.j.insert(wave.j.end(), packet.j.begin(), packet.j.end());
+            for (int y = part.y0 ; y < part.y1 ; y++) {
+                for (int x = part.x0 ; x < part.x1 ; x++) {
+                    xs.push_back(x - frame.originX);
+                    ys.push_back(y - frame.originY);
+                }
+            }
+        }
+    }
+    if (wave.Size() == 0) {
+        return;
+    }
+    vector<Color> colors(wave.Size());
+    vector<int> objectIds(wave.Size());
+    ray_tracer.TraceWaves(wave, scene, &colors[0], &objectIds[0]);
+    for (int k = 0; k < wave.Size(); ++k) {
+        frame.ColorAt(xs[k], ys[k]) = colors[k];
+        frame.ObjectAt(xs[k], ys[k]) = objectIds[k];
+    }
+}
+
+void TraceTile(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, const Tile& tile, FrameBuffer& frame) {
+    if (ray_tracer.sortRays) {
+        TraceTileWaves(ray_tracer, rays, scene, tile, frame);
+        return;
+    }
+    RayPacket packet;
+    if (ray_tracer.packetSize <= 0) {
+        rays.TileRays(tile, 0.5, 0.5, packet);
+        int k = 0;
+        for (int y = tile.y0 ; y < tile.y1 ; y++) {
+            for (int x = tile.x0 ; x < tile.x1 ; x++, k++) { 
+                int fx = x - frame.originX, fy = y - frame.originY;
+                const Object* hitObject;
+                frame.ColorAt(fx, fy) = ray_tracer.GetColor(packet.At(k), scene, 0, packet.i[k], packet.j[k], &hitObject);
+                frame.ObjectAt(fx, fy) = hitObject == NULL? 0 : hitObject->index;
+            }
+        }
+        return;
+    }
+
+    // Small square packets keep the rays of a packet close, whatever the tile size
+    int size = ray_tracer.packetSize;
+    vector<Color> colors(size * size);
+    vector<int> objectIds(size * size);
+    for (int py = tile.y0 ; py < tile.y1 ; py += size) {
+        for (int px = tile.x0 ; px < tile.x1 ; px += size) {
+            Tile part(px, py, min(px + size, tile.x1), min(py + size, tile.y1));
+            rays.TileRays(part, 0.5, 0.5, packet);
+            ray_tracer.TracePacket(packet, scene, &colors[0], &objectIds[0]);
+            int k = 0;
+            for (int y = part.y0 ; y < part.y1 ; y++) {
+                for (int x = part.x0 ; x < part.x1 ; x++, k++) {
+                    frame.ColorAt(x - frame.originX, y - frame.originY) = colors[k];
+                    frame.ObjectAt(x - frame.originX, y - frame.originY) = objectIds[k];
+                }
+            }
+        }
+    }
+}
+
+bool IsContrasted(const Color& a, const Color& b, float threshold) {
+    return fabs(a.r - b.r) > threshold || fabs(a.g - b.g) > threshold || fabs(a.b - b.b) > threshold;
+}
+
+// Pixels that differ from a neighbor by more than the threshold or see another object. The decision
+// only looks at the frame as it is, refined pixels must not spread to their neighbors
+static void EdgeMask(const FrameBuffer& frame, float threshold, vector<bool>& refine) {
+    int width = frame.width;
+    int height = frame.height;
+    refine.assign(width * height, false);
+    for (int y = 0 ; y < height ; y++) {
+        for (int x = 0 ; x < width ; x++) {
+            const int dx[2] = {1, 0};
+            const int dy[2] = {0, 1};
+            for (int k = 0 ; k < 2 ; k++) {
+                int nx = x + dx[k], ny = y + dy[k];
+                if (nx >= width || ny >= height) {
+                    continue;
+                }
+                if (frame.ObjectAt(x, y) != frame.ObjectAt(nx, ny) || 
+                    IsContrasted(frame.ColorAt(x, y), frame.ColorAt(nx, ny), threshold)) {
+                    refine[y * width + x] = true;
+                    refine[ny * width + nx] = true;
+                }
+            }
+        }
+    }
+}
+
+// Sum of one sample at the center of each of the n x n strata of pixel (x, y) of the frame
+static Color StrataSum(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, int n, const FrameBuffer& frame, int x, int y) {
+    Color sum;
+    for (int sy = 0 ; sy < n ; sy++) {
+        for (int sx = 0 ; sx < n ; sx++) {
+            sum = sum + TraceSample(ray_tracer, rays, scene, frame.originY + y + (sy+0.5) / n, frame.originX + x + (sx+0.5) / n);
+        }
+    }
+    return sum;
+}
+
+int RefineEdges(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, int n, float threshold, FrameBuffer& frame, const Deadline* deadline) {
+    int width = frame.width;
+    int height = frame.height;
+    vector<bool> refine;
+    EdgeMask(frame, threshold, refine);
+
+    int refined = 0;
+    for (int y = 0 ; y < height ; y++) {
+        for (int x = 0 ; x < width ; x++) {
+            if (!refine[y * width + x]) {
+                continue;
+            }
+            if (deadline != NULL && chrono::steady_clock::now() > *deadline) {
+                return refined;
+            }
+            frame.ColorAt(x, y) = StrataSum(ray_tracer, rays, scene, n, frame, x, y) * (1.0 / (n*n));
+            refined++;
+        }
+    }
+    return refined;
+}
+
+void TraceProgressive(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, const RenderOptions& options, FrameBuffer& frame, const Deadline& deadline) {
+    int width = frame.width;
+    int height = frame.height;
+    
+    // Each stride traces the pixels on its grid that the coarser strides skipped and
+    // spreads them over their stride x stride block, which holds no finer grid point yet
+    int stride = 32;
+    int finished = 0; // Finest stride traced completely, 0 for none
+    for ( ; stride >= 1 ; stride /= 2) {
+        bool first = stride == 32;
+        for (int y = 0 ; y < height ; y += stride) {
+            for (int x = 0 ; x < width ; x += stride) {
+                if (!first && x % (2*stride) == 0 && y % (2*stride) == 0) {
+                    continue;
+                }
+                // The first pass always completes, it is the guaranteed image
+                if (!first && chrono::steady_clock::now() > deadline) {
+                    cout << "Progressive: time budget reached, finest complete stride " << finished << ".\n";
+                    return;
+                }
+                int objectId;
+                Color color = TraceSample(ray_tracer, rays, scene, frame.originY + y + 0.5, frame.originX + x + 0.5, &objectId);
+                for (int by = y ; by < min(y + stride, height) ; by++) {
+                    for (int bx = x ; bx < min(x + stride, width) ; bx++) {
+                        frame.ColorAt(bx, by) = color;
+                        frame.ObjectAt(bx, by) = objectId;
+                    }
+                }
+            }
+        }
+        finished = stride;
+    }
+
+    // Every pixel has its own sample, spend the rest of the budget on the edges. They are found once on
+    // the pixel centers, and each level adds its n x n samples to those the pixel already has
+    vector<bool> refine;
+    EdgeMask(frame, options.aaThreshold, refine);
+    vector<Color> sums(frame.colors);
+    vector<int> counts(width * height, 1);
+    int maxSamples = max(options.aaSamples, 4);
+    for (int n = 2 ; n <= maxSamples && chrono::steady_clock::now() < deadline ; n++) {
+        int refined = 0;
+        for (int p = 0 ; p < width * height && chrono::steady_clock::now() < deadline ; p++) {
+            if (!refine[p]) {
+                continue;
+            }
+            int x = p % width, y = p / width;
+            sums[p] = sums[p] + StrataSum(ray_tracer, rays, scene, n, frame, x, y);
+            counts[p] += n*n;
+            frame.ColorAt(x, y) = sums[p] * (1.0 / counts[p]);
+            refined++;
+        }
+        cout << "Progressive: " << refined << " edge pixels with " << n << "x" << n << " more samples.\n";
+    }
+}
+
+int TraceFrame(RayTracer& ray_tracer, const Camera& camera, const Scene& scene, const RenderOptions& options, FrameBuffer& frame, WorkerPool* pool) {
+    CameraRays rays(camera, scene.width, scene.height);
+    if (pool != NULL) {
+        pool->Trace(frame);
+    }
+    else if (options.workers > 0 || !options.workerCommands.empty()) {
+        TraceDistributed(camera, scene, options, frame);
+    }
+    else {
+        vector<Tile> tiles;
+        BuildTiles(frame.width, frame.height, options, tiles, frame.originX, frame.originY);
+
+        for (int t = 0 ; t < (int)tiles.size() ; t++) {
+            TraceTile(ray_tracer, rays, scene, tiles[t], frame);
+        }
+    }
+
+    if (options.aaSamples > 1) {
+        return RefineEdges(ray_tracer, rays, scene, options.aaSamples, options.aaThreshold, frame);
+    }
+    return 0;
+}
+
+BYTE* RayTrace (Camera camera, const Scene& scene, const RenderOptions& options)  {
+        RayTracer ray_tracer(options.lightCutoff, options.lightSamples, options.packetSize, options.sortRays, options.areaSamples, options.areaMaxSamples);
+        int width = scene.width;
+        int height = scene.height;
+
+        // The crop is traced with the pixels around it that anti-aliasing compares it with,
+        // so it gets the colors of a full render
+        Tile crop = CropWindow(options, width, height);
+        int margin = options.aaSamples > 1? 1 : 0;
+        int left = max(crop.x0 - margin, 0), top = max(crop.y0 - margin, 0);
+        FrameBuffer frame(min(crop.x1 + margin, width) - left, min(crop.y1 + margin, height) - top, left, top);
+        int pix = frame.width * frame.height;
+
+        if (!options.gbufferFile.empty()) {
+            // Traced here, the G-buffer needs every pixel center of this process
+            GBuffer gbuffer;
+            CameraRays rays(camera, width, height);
+            CaptureGBuffer(ray_tracer, rays, scene, gbuffer, frame);
+            if (!gbuffer.Save(options.gbufferFile)) {
+                cerr << "Writing " << options.gbufferFile << " failed!" << endl;
+            }
+            if (options.aaSamples > 1) {
+                cout << "Anti-aliasing: refined " << RefineEdges(ray_tracer, rays, scene, options.aaSamples, options.aaThreshold, frame) << " of " << pix << " pixels, the G-buffer keeps the pixel centers.\n";
+            }
+        }
+        else if (options.timeBudgetMs > 0) {
+            Deadline deadline = chrono::steady_clock::now() + chrono::milliseconds(options.timeBudgetMs);
+            TraceProgressive(ray_tracer, CameraRays(camera, width, height), scene, options, frame, deadline);
+        }
+        else {
+            int refined = TraceFrame(ray_tracer, camera, scene, options, frame);
+            if (options.aaSamples > 1) {
+                cout << "Anti-aliasing: refined " << refined << " of " << pix << " pixels.\n";
+            }
+        }
+
+        // Stochastic shading (area lights, light samples) smoothed where the guides show no edge
+        if (options.denoisePasses > 0) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            DenoiseGuides guides;
+            CaptureGuides(ray_tracer, CameraRays(camera, width, height), scene, frame, guides);
+            Denoise(guides, options.denoisePasses, frame);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            cout << "Denoising: " << options.denoisePasses << " passes in " << ms << " ms\n";
+        }
+
+        Tile output = OutputArea(options, crop, width, height);
+        int outWidth = output.x1 - output.x0, outHeight = output.y1 - output.y0;
+        FrameBuffer placed(0, 0);
+        const FrameBuffer* saved = &frame;
+        if (!SameArea(frame, crop) || !SameArea(frame, output)) {
+            placed = FrameBuffer(outWidth, outHeight);
+            CopyCrop(frame, crop, output, placed);
+            saved = &placed;
+        }
+        else {
+            frame.originX = frame.originY = 0; // The frame is the saved image, WritePfm counts rows from its top
+        }
+
+        if (!options.hdrFile.empty() && !WritePfm(options.hdrFile, *saved)) {
+            cerr << "Writing " << options.hdrFile << " failed!" << endl;
+        }
+
+        // The tone mapping stage is the only place where colors become bytes
+        BYTE* image = new BYTE[3 * outWidth * outHeight];
+        for (int y = 0 ; y < outHeight ; y++) {
+            ToneMapRow(&saved->ColorAt(0, y), outWidth, options, image + 3 * (outHeight-y-1) * outWidth, true);
+		}
+        return image;
+}
+
+bool RayTraceStreamed(const Camera& camera, const Scene& scene, const RenderOptions& options, const string& fname) {
+    RayTracer ray_tracer(options.lightCutoff, options.lightSamples, options.packetSize, options.sortRays, options.areaSamples, options.areaMaxSamples);
+    int width = scene.width;
+    int height = scene.height;
+    Tile crop = CropWindow(options, width, height);
+    Tile output = OutputArea(options, crop, width, height);
+    int outWidth = output.x1 - output.x0, outHeight = output.y1 - output.y0;
+
+    PngStreamWriter png;
+    if (!png.Open(fname, outWidth, outHeight)) {
+        cerr << "Open " << fname << " failed!" << endl;
+        return false;
+    }
+    cout << "Streaming " << fname << " in bands of " << options.bandHeight << " rows\n";
+    if (options.timeBudgetMs > 0) {
+        cout << "The time budget is ignored when streaming.\n";
+    }
+    if (!options.gbufferFile.empty()) {
+        cout << "The G-buffer is not written when streaming.\n";
+    }
+    if (options.denoisePasses > 0) {
+        cout << "The denoiser needs the whole frame, it is skipped when streaming.\n";
+    }
+
+    PfmWriter pfm;
+    bool hdr = !options.hdrFile.empty();
+    if (hdr && !pfm.Open(options.hdrFile, outWidth, outHeight)) {
+        cerr << "Open " << options.hdrFile << " failed!" << endl;
+        hdr = false;
+    }
+
+    // Anti-aliasing compares each pixel with its neighbors, so the band also traces the
+    // pixels just around it to refine the same pixels as a full frame would
+    int overlap = options.aaSamples > 1? 1 : 0;
+    int left = max(crop.x0 - overlap, 0), right = min(crop.x1 + overlap, width);
+
+    WorkerPool* pool = NULL;
+    if (options.workers > 0 || !options.workerCommands.empty()) {
+        pool = new WorkerPool(camera, scene, options);
+    }
+
+    // PNG rows go from top to bottom, like the bands. Bands outside the crop stay black
+    int refined = 0;
+    vector<BYTE> row(3 * outWidth);
+    for (int y0 = output.y0 ; y0 < output.y1 ; y0 += options.bandHeight) {
+        int y1 = min(y0 + options.bandHeight, output.y1);
+        FrameBuffer rows(outWidth, y1 - y0, 0, y0 - output.y0);
+        if (y0 < crop.y1 && y1 > crop.y0) {
+            int top = max(max(y0, crop.y0) - overlap, 0), bottom = min(min(y1, crop.y1) + overlap, height);
+            FrameBuffer band(right - left, bottom - top, left, top);
+            refined += TraceFrame(ray_tracer, camera, scene, options, band, pool);
+            CopyCrop(band, crop, output, rows);
+        }
+
+        if (hdr) {
+            pfm.WriteRows(rows, rows.originY, rows.height);
+        }
+        for (int y = 0 ; y < rows.height ; y++) {
+            ToneMapRow(&rows.ColorAt(0, y), outWidth, options, &row[0]);
+            png.WriteRow(&row[0]);
+        }
+    }
+    delete pool;
+    if (options.aaSamples > 1) {
+        cout << "Anti-aliasing: refined " << refined << " pixels, band overlaps included.\n";
+    }
+    if (hdr && !pfm.Close()) {
+        cerr << "Writing " << options.hdrFile << " failed!" << endl;
+    }
+    return png.Close();
+}
+
+void RenderToFile(const Camera& camera, const Scene& scene, const RenderOptions& options, const string& fname, SaveQueue* queue) {
+    if (options.cropX1 > 0 && (options.cropX0 >= scene.width || options.cropY0 >= scene.height)) {
+        cerr << "The crop window is outside the " << scene.width << "x" << scene.height << " image, it is traced whole" << endl;
+    }
+    if (options.bandHeight > 0) {
+        if (!RayTraceStreamed(camera, scene, options, fname)) {
+            cerr << "Writing " << fname << " failed!" << endl;
+        }
+        return;
+    }
+    Tile output = OutputArea(options, CropWindow(options, scene.width, scene.height), scene.width, scene.height);
+    BYTE* image = RayTrace(camera, scene, options);
+    if (queue != NULL) {
+        queue->Push(fname, image, output.x1 - output.x0, output.y1 - output.y0);
+        return;
+    }
+    SaveScreenshot(fname, image, output.x1 - output.x0, output.y1 - output.y0);
+    delete[] image;
+}
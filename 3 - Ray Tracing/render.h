@@ -0,0 +1,75 @@
+#include <chrono>
+#include "raytracer.h"
+#include "options.h"
+#include "traversal.h"
+#include "camerarays.h"
+
+#ifndef RENDER_H
+#define RENDER_H
+
+// Largest width or height of an image read from a job or a file
+const int MAX_IMAGE_SIZE = 16384;
+
+// Float colors of a frame before they are quantized, rows from top to bottom like the RayTrace loop.
+// It may hold only a band or a tile of the image, whose top left pixel is (originX, originY)
+struct FrameBuffer {
+    int width, height;
+    int originX, originY;
+    vector<Color> colors;
+    vector<int> objectIds; // Object::index seen by the pixel center, 0 for the background
+    
+    FrameBuffer(int _width, int _height, int _originX = 0, int _originY = 0);
+    Color& ColorAt(int x, int y) { return colors[y * width + x]; }
+    const Color& ColorAt(int x, int y) const { return colors[y * width + x]; }
+    int& ObjectAt(int x, int y) { return objectIds[y * width + x]; }
+    int ObjectAt(int x, int y) const { return objectIds[y * width + x]; }
+};
+
+// One ray through the point (i, j) of the image plane
+Color TraceSample(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, float i, float j, int* objectId = NULL);
+
+// Traces one sample per pixel of the tile, given in image coordinates inside the frame
+void TraceTile(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, const Tile& tile, FrameBuffer& frame);
+
+typedef chrono::steady_clock::time_point Deadline;
+
+class SaveQueue;
+class WorkerPool;
+
+// Re-traces with n x n stratified samples the pixels that differ from a neighbor by more
+// than the contrast threshold or see another object. Returns the number of refined pixels,
+// it stops early once the deadline (if any) has passed
+int RefineEdges(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, int n, float threshold, FrameBuffer& frame, const Deadline* deadline = NULL);
+
+// Coarse interleaved pass first, then finer strides and finally more samples on the edges of the
+// pixel centers until the deadline, each level adding to the samples of the previous ones. Untraced
+// pixels copy the closest traced one, so the frame is always complete
+void TraceProgressive(RayTracer& ray_tracer, const CameraRays& rays, const Scene& scene, const RenderOptions& options, FrameBuffer& frame, const Deadline& deadline);
+
+// Samples the frame (locally along the tile order, or on the workers), then the anti-aliasing
+// pass when it is on. Returns the number of refined pixels. A pool, when given, traces the samples
+int TraceFrame(RayTracer& ray_tracer, const Camera& camera, const Scene& scene, const RenderOptions& options, FrameBuffer& frame, WorkerPool* pool = NULL);
+
+// The pixels --crop asks for, clipped to the image. The whole image without a crop, when the crop
+// is outside the image, or when the G-buffer is written since it needs every pixel
+Tile CropWindow(const RenderOptions& options, int width, int height);
+
+void SaveScreenshot(string fname, BYTE* image, int width, int height);
+
+// Tone maps a whole frame into a PNG, and writes the PFM too when options.hdrFile is set. With a
+// queue the PNG is saved on its thread
+void SaveFrame(const FrameBuffer& frame, const RenderOptions& options, const string& fname, SaveQueue* queue = NULL);
+
+// Renders the scene into a BGR image, rows from bottom to top as FreeImage wants them. The image
+// is the crop window, or the full size with --crop-full
+BYTE* RayTrace(Camera camera, const Scene& scene, const RenderOptions& options);
+
+// Renders bands of options.bandHeight rows and appends them to a PNG, so the memory
+// depends on the band and not on the image size. The workers, if any, are started once for all
+// the bands. Returns false when the file can't be written
+bool RayTraceStreamed(const Camera& camera, const Scene& scene, const RenderOptions& options, const string& fname);
+
+// Streamed when options.bandHeight is set, otherwise RayTrace and SaveScreenshot, on the thread of
+// the queue when there is one. Streamed rows are written as they are traced, never queued
+void RenderToFile(const Camera& camera, const Scene& scene, const RenderOptions& options, const string& fname, SaveQueue* queue = NULL);
+#endif // RENDER_H
@@ -0,0 +1,120 @@
+#include <cstring>
+#include <algorithm>
+#include "rng.h"
+
+// Philox 4x32 multipliers and key increments (Salmon et al., Random123)
+static const unsigned int PHILOX_M0 = 0xD2511F53u;
+static const unsigned int PHILOX_M1 = 0xCD9E8D57u;
+static const unsigned int PHILOX_W0 = 0x9E3779B9u;
+static const unsigned int PHILOX_W1 = 0xBB67AE85u;
+static const int PHILOX_ROUNDS = 10;
+
+RandomStream::RandomStream(unsigned int pixel, unsigned int sample, unsigned int bounce, unsigned int seed) {
+    counter[0] = pixel;
+    counter[1] = sample;
+    counter[2] = bounce;
+    key[0] = seed;
+    key[1] = 0x5EED5EEDu; // Any constant, keeps the second key word away from zero
+}
+
+RandomStream RandomStream::ForImagePoint(float i, float j, int bounce, unsigned int seed) {
+    unsigned int bits[2];
+    memcpy(&bits[0], &i, sizeof(float));
+    memcpy(&bits[1], &j, sizeof(float));
+    return RandomStream(bits[0], bits[1], bounce, seed);
+}
+
+// Blocks blocks[0 .. lanes-1] of the stream, word w of block k in out[4*k + w]
+static void PhiloxBlocks(const unsigned int* counter, const unsigned int* key, const unsigned int* blocks, int lanes, unsigned int* out) {
+    unsigned int c0[RNG_LANES], c1[RNG_LANES], c2[RNG_LANES], c3[RNG_LANES];
+    for (int k = 0; k < RNG_LANES; ++k) {
+        c0[k] = counter[0];
+        c1[k] = counter[1];
+        c2[k] = counter[2];
+        c3[k] = k < lanes? blocks[k] : 0;
+    }
+    unsigned int k0 = key[0], k1 = key[1];
+    for (int round = 0; round < PHILOX_ROUNDS; ++round) {
+        for (int k = 0; k < RNG_LANES; ++k) {
+            unsigned long long p0 = (unsigned long long)PHILOX_M0 * c0[k];
+            unsigned long long p1 = (unsigned long long)PHILOX_M1 * c2[k];
+            unsigned int hi0 = p0 >> 32, lo0 = (unsigned int)p0;
+            unsigned int hi1 = p1 >> 32, lo1 = (unsigned int)p1;
+            c0[k] = hi1 ^ c1[k] ^ k0;
+            c1[k] = lo1;
+            c2[k] = hi0 ^ c3[k] ^ k1;
+            c3[k] = lo0;
+        }
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    for (int k = 0; k < lanes; ++k) {
+        out[4*k] = c0[k];
+        out[4*k + 1] = c1[k];
+        out[4*k + 2] = c2[k];
+        out[4*k + 3] = c3[k];
+    }
+}
+
+unsigned int RandomStream::UInt(unsigned int n) const {
+    unsigned int block = n / 4;
+    unsigned int words[4];
+    PhiloxBlocks(counter, key, &block, 1, words);
+    return words[n % 4];
+}
+
+float RandomStream::Float(unsigned int n) const {
+    return (UInt(n) >> 8) * (1.0f / 16777216);
+}
+
+void RandomStream::UInts(unsigned int first, int count, unsigned int* out) const {
+    unsigned int blocks[RNG_LANES];
+    unsigned int words[4 * RNG_LANES];
+    unsigned int n = first;
+    int done = 0;
+    while (done < count) {
+        // Blocks covering numbers n .. n + 4*RNG_LANES - 1
+        int lanes = 0;
+        for ( ; lanes < RNG_LANES && (int)(4*lanes - n % 4) < count - done; ++lanes) {
+            blocks[lanes] = n / 4 + lanes;
+        }
+        PhiloxBlocks(counter, key, blocks, lanes, words);
+        int offset = n % 4;
+        int take = std::min(4*lanes - offset, count - done);
+        for (int k = 0; k < take; ++k) {
+            out[done + k] = words[offset + k];
+        }
+        done += take;
+        n += take;
+    }
+}
+
+void RandomStream::Floats(unsigned int first, int count, float* out) const {
+    unsigned int bits[4 * RNG_LANES];
+    for (int done = 0; done < count; done += 4 * RNG_LANES) {
+        int take = std::min(4 * RNG_LANES, count - done);
+        UInts(first + done, take, bits);
+        for (int k = 0; k < take; ++k) {
+            out[done + k] = (bits[k] >> 8) * (1.0f / 16777216);
+        }
+    }
+}
+
+void Sobol2D(unsigned int n, const unsigned int* scramble, float* u) {
+    // First dimension: the bits of n reversed (van der Corput)
+    unsigned int x = n;
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00FF00FFu) << 8) | ((x & 0xFF00FF00u) >> 8);
+    x = ((x & 0x0F0F0F0Fu) << 4) | ((x & 0xF0F0F0F0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xCCCCCCCCu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xAAAAAAAAu) >> 1);
+    // Second dimension: direction numbers from Pascal's triangle mod 2
+    unsigned int y = 0;
+    for (unsigned int v = 1u << 31; n != 0; n >>= 1, v ^= v >> 1) {
+        if (n & 1) {
+            y ^= v;
+        }
+    }
+    u[0] = ((x ^ scramble[0]) >> 8) * (1.0f / 16777216);
+    u[1] = ((y ^ scramble[1]) >> 8) * (1.0f / 16777216);
+}
\ No newline at end of file
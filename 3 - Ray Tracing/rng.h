@@ -0,0 +1,34 @@
+#ifndef RNG_H
+#define RNG_H
+
+// Numbers made per batch step, one Philox block of four per lane
+const int RNG_LANES = 8;
+
+// Counter based random numbers (Philox 4x32-10): the n-th number of a stream is a pure function of
+// (pixel, sample, bounce, n) and the seed, so threads, tiles and workers never share generator state
+// and get the same numbers whatever the order they trace in
+class RandomStream {
+public:
+    RandomStream(unsigned int pixel, unsigned int sample, unsigned int bounce, unsigned int seed = 0);
+
+    // Stream of a camera sample named by its point on the image plane (row i, column j): the integer
+    // parts are the pixel, the exact floats also tell apart the samples inside it
+    static RandomStream ForImagePoint(float i, float j, int bounce, unsigned int seed = 0);
+
+    unsigned int UInt(unsigned int n) const;
+    float Float(unsigned int n) const; // In [0, 1), 24 random bits
+
+    // Numbers first .. first+count-1, RNG_LANES blocks of four at a time in plain loops that vectorize
+    void UInts(unsigned int first, int count, unsigned int* out) const;
+    void Floats(unsigned int first, int count, float* out) const;
+
+private:
+    unsigned int counter[3]; // pixel, sample, bounce; the block number is the fourth word
+    unsigned int key[2];
+};
+
+// Point n of the first two dimensions of the Sobol sequence, a (0,2)-sequence: the first 2^k points put
+// one point in each of 2^k equal strips along both axes. XOR with the scramble words keeps that and
+// decorrelates the pixels
+void Sobol2D(unsigned int n, const unsigned int* scramble, float* u);
+#endif // RNG_H
\ No newline at end of file
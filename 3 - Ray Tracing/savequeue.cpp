@@ -0,0 +1,63 @@
+#include <iostream>
+#include "savequeue.h"
+
+SaveQueue::SaveQueue(int _capacity) : capacity(max(_capacity, 1)), images(0), stopping(false) {
+    writer = thread(&SaveQueue::Run, this);
+}
+
+SaveQueue::~SaveQueue() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    writer.join();
+}
+
+void SaveQueue::Push(const string& fname, BYTE* image, int width, int height) {
+    Job job = {fname, image, width, height, ""};
+    Add(job);
+}
+
+void SaveQueue::Print(const string& message) {
+    Job job = {"", NULL, 0, 0, message};
+    Add(job);
+}
+
+void SaveQueue::Add(const Job& job) {
+    unique_lock<mutex> guard(lock);
+    while (job.image != NULL && images >= capacity) {
+        changed.wait(guard);
+    }
+    jobs.push_back(job);
+    images += job.image != NULL? 1 : 0;
+    changed.notify_all();
+}
+
+void SaveQueue::Run() {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        while (jobs.empty() && !stopping) {
+            changed.wait(guard);
+        }
+        if (jobs.empty()) {
+            return;
+        }
+        Job job = jobs.front();
+        jobs.pop_front();
+
+        // The tracing thread goes on while the file is written
+        guard.unlock();
+        if (job.image != NULL) {
+            SaveScreenshot(job.fname, job.image, job.width, job.height);
+            delete[] job.image;
+        }
+        else {
+            cout << job.message << flush;
+        }
+        guard.lock();
+
+        images -= job.image != NULL? 1 : 0;
+        changed.notify_all();
+    }
+}
\ No newline at end of file
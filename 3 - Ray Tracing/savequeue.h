@@ -0,0 +1,39 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "render.h"
+
+#ifndef SAVEQUEUE_H
+#define SAVEQUEUE_H
+
+// Saves finished images on a thread of its own, so the next frame is traced while FreeImage compresses
+// the last one. At most capacity images (3 bytes per pixel) wait or are being saved, Push blocks while
+// that many are. Messages come out in the order they were given, after the images pushed before them
+class SaveQueue {
+public:
+    SaveQueue(int _capacity);
+    ~SaveQueue(); // Saves what is left, then joins the thread
+
+    // Takes a BGR image allocated with new[], like the one of RayTrace, and deletes it once saved
+    void Push(const string& fname, BYTE* image, int width, int height);
+    void Print(const string& message);
+
+private:
+    struct Job {
+        string fname; // Empty for a message
+        BYTE* image;
+        int width, height;
+        string message;
+    };
+    void Add(const Job& job);
+    void Run();
+
+    deque<Job> jobs;
+    int capacity, images; // Images queued or being saved
+    bool stopping;
+    mutex lock;
+    condition_variable changed;
+    thread writer;
+};
+#endif // SAVEQUEUE_H
\ No newline at end of file
@@ -21,6 +21,109 @@ void rightmultiply(const mat4 & M, stack<mat4> &transfstack) {
     T = M * T; 
 }
 
+mat4 TransformStep::At(float t) const {
+    if (type == fixed) {
+        return matrix;
+    }
+    int width = type == rotate? 2 : 4; // A time and its values
+    int count = keys.size() / width;
+    // Last key at or before t, blended with the next one. Before the first and after the last the ends hold
+    int k = 0;
+    while (k + 1 < count && keys[(k+1) * width] <= t) {
+        k++;
+    }
+    float v[3];
+    for (int c = 0; c < width - 1; ++c) {
+        v[c] = keys[k * width + 1 + c];
+        if (k + 1 < count && t > keys[k * width]) {
+            float t0 = keys[k * width], t1 = keys[(k+1) * width];
+            v[c] += (keys[(k+1) * width + 1 + c] - v[c]) * ((t - t0) / (t1 - t0));
+        }
+    }
+    if (type == translate) {
+        return Transform::translate(v[0], v[1], v[2]);
+    }
+    if (type == scale) {
+        return Transform::scale(v[0], v[1], v[2]);
+    }
+    return mat4(Transform::rotate(v[0], axis));
+}
+
+bool TransformStep::operator == (const TransformStep& other) const {
+    return type == other.type && matrix == other.matrix && axis == other.axis && keys == other.keys;
+}
+
+// A fixed command after a keyframed one is a step of its own, so the product keeps the order of the stack
+static void AddFixedStep(const mat4& M, stack<vector<TransformStep> >& stepstack) {
+    if (!stepstack.top().empty()) {
+        TransformStep step;
+        step.type = TransformStep::fixed;
+        step.matrix = M;
+        stepstack.top().push_back(step);
+    }
+}
+
+static bool IsAnimated(const vector<AnimatedTransform>& animatedTransforms, const ObjectTransform* entry) {
+    for (int i = 0; i < (int)animatedTransforms.size(); ++i) {
+        if (animatedTransforms[i].entry == entry) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Objects only get a new table entry when the material state really changed since the last one
+MaterialId Scene::InternMaterials() {
+    if (materialsChanged || materialTable.empty()) {
+        materialsChanged = false;
+        for (int i = (int)materialTable.size() - 1; i >= 0; --i) {
+            if (materialTable[i] == materials) {
+                currentMaterial = i;
+                return currentMaterial;
+            }
+        }
+        materialTable.push_back(materials);
+        currentMaterial = materialTable.size() - 1;
+    }
+    return currentMaterial;
+}
+
+// Objects created under the same matrix share one entry and its precomputed inverse. Animated
+// entries are only shared by the same steps, the matrices of different steps part after time 0
+const ObjectTransform* Scene::InternTransform(const mat4& top, const vector<TransformStep>& steps) {
+    if (!steps.empty()) {
+        for (int i = 0; i < (int)animatedTransforms.size(); ++i) {
+            if (animatedTransforms[i].steps == steps) {
+                return animatedTransforms[i].entry;
+            }
+        }
+        AnimatedTransform animated;
+        animated.entry = new ObjectTransform(top);
+        animated.steps = steps;
+        transformTable.push_back(animated.entry);
+        animatedTransforms.push_back(animated);
+        return animated.entry;
+    }
+    if (currentTransform == NULL || currentTransform->transform != top) {
+        currentTransform = NULL;
+        for (int i = (int)transformTable.size() - 1; i >= 0; --i) {
+            if (transformTable[i]->transform == top && !IsAnimated(animatedTransforms, transformTable[i])) {
+                currentTransform = transformTable[i];
+                break;
+            }
+        }
+        if (currentTransform == NULL) {
+            transformTable.push_back(new ObjectTransform(top));
+            currentTransform = transformTable.back();
+        }
+    }
+    return currentTransform;
+}
+
+const Materials& Scene::GetMaterials(const Object* object) const {
+    return materialTable[object->materialId];
+}
+
 // Function to read the input data values
 // Use is optional, but should be very helpful in parsing.  
 bool Scene::readvals(stringstream &s, const int numvals, float *values) {
@@ -34,6 +137,41 @@ bool Scene::readvals(stringstream &s, const int numvals, float *values) {
     return true; 
 }
 
+bool Scene::readkeys(stringstream &s, const int numvals, vector<float>& keys) {
+    float value;
+    while (s >> value) {
+        keys.push_back(value);
+    }
+    if (keys.empty() || keys.size() % (numvals + 1) != 0) {
+        cout << "Keys need a time and " << numvals << " values each, will skip\n";
+        return false;
+    }
+    for (int i = numvals + 1; i < (int)keys.size(); i += numvals + 1) {
+        if (keys[i] <= keys[i - numvals - 1]) {
+            cout << "Key times must increase, will skip\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Scene::SetTime(float t) {
+    time = t;
+    bool changed = false;
+    for (int i = 0; i < (int)animatedTransforms.size(); ++i) {
+        AnimatedTransform& animated = animatedTransforms[i];
+        mat4 top(1.0);
+        for (int k = 0; k < (int)animated.steps.size(); ++k) {
+            top = animated.steps[k].At(t) * top; // Same order as rightmultiply
+        }
+        if (top != animated.entry->transform) {
+            *animated.entry = ObjectTransform(top);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
 void Scene::readfile(const string &filename) {
         string str, cmd ; 
         ifstream in ;
@@ -46,6 +184,9 @@ void Scene::readfile(const string &filename) {
         // This is done using standard STL Templates 
         stack<mat4> transfstack ; 
         transfstack.push(mat4(1.0)) ;  // identity
+        // Steps of each stack level, empty until a keyframed command, then the product of the level
+        stack<vector<TransformStep> > stepstack;
+        stepstack.push(vector<TransformStep>());
 
         getline (in, str) ; 
         while (in) {
@@ -57,7 +198,7 @@ void Scene::readfile(const string &filename) {
                 stringstream s(str);
                 s >> cmd; 
                 int i; 
-                float values[10]; // position and color for light, colors for others
+                float values[12]; // position and color for light (and sides for quad lights), colors for others
                 // Up to 10 params for cameras.  
                 bool validinput ; // validity of input 
         
@@ -96,9 +237,8 @@ void Scene::readfile(const string &filename) {
 					Sphere* sphere = new Sphere(vec3(values[0], values[1], values[2]), values[3]);
 					objects.push_back(sphere);
 					objects.back()->index = objects.size();
-					objects.back()->materials = materials;
-					objects.back()->transform = transfstack.top();
-					objects.back()->InversedTransform = glm::inverse(transfstack.top());
+					objects.back()->materialId = InternMaterials();
+					objects.back()->transform = InternTransform(transfstack.top(), stepstack.top());
 				}            
 				else if (cmd == "maxverts") {
 					validinput = readvals(s, 1, values);
@@ -132,9 +272,8 @@ void Scene::readfile(const string &filename) {
 						vertexBuffer[values[0]], vertexBuffer[values[1]], vertexBuffer[values[2]]);
 						objects.push_back(triangle);
                         objects.back()->index = objects.size();
-                        objects.back()->materials = materials;
-                        objects.back()->transform = transfstack.top();
-                        objects.back()->InversedTransform = glm::inverse(transfstack.top());
+                        objects.back()->materialId = InternMaterials();
+                        objects.back()->transform = InternTransform(transfstack.top(), stepstack.top());
                     }
                 }
 				else if (cmd == "trinormal") {
@@ -144,9 +283,8 @@ void Scene::readfile(const string &filename) {
                                                 vertexNormalBuffer[values[0]], vertexNormalBuffer[values[1]], vertexNormalBuffer[values[2]]);
                         objects.push_back(triangle);
                         objects.back()->index = objects.size();
-                        objects.back()->materials = materials;
-                        objects.back()->transform = transfstack.top();
-                        objects.back()->InversedTransform = glm::inverse(transfstack.top());
+                        objects.back()->materialId = InternMaterials();
+                        objects.back()->transform = InternTransform(transfstack.top(), stepstack.top());
                     }
                 }
 
@@ -157,6 +295,7 @@ void Scene::readfile(const string &filename) {
 						Light light;
 						light.position_direction = vec3(values[0], values[1], values[2]);
 						light.color = Color(values[3], values[4], values[5]);
+						light.radius = 0;
 						if (cmd == "directional") {
 							light.type = Light::directional;
 						}
@@ -166,6 +305,32 @@ void Scene::readfile(const string &filename) {
 						lights.push_back(light);
 					}
                 }
+                // Area lights: a quad from a corner and two sides, or a sphere. The color is the
+                // whole light, as bright as a point light at the center
+                else if (cmd == "quadlight") {
+                    validinput = readvals(s, 12, values);
+                    if (validinput) {
+                        Light light;
+                        light.type = Light::quad;
+                        light.edgeU = vec3(values[3], values[4], values[5]);
+                        light.edgeV = vec3(values[6], values[7], values[8]);
+                        light.position_direction = vec3(values[0], values[1], values[2]) + (light.edgeU + light.edgeV) * 0.5f;
+                        light.color = Color(values[9], values[10], values[11]);
+                        light.radius = 0;
+                        lights.push_back(light);
+                    }
+                }
+                else if (cmd == "spherelight") {
+                    validinput = readvals(s, 7, values);
+                    if (validinput) {
+                        Light light;
+                        light.type = Light::sphere;
+                        light.position_direction = vec3(values[0], values[1], values[2]);
+                        light.radius = values[3];
+                        light.color = Color(values[4], values[5], values[6]);
+                        lights.push_back(light);
+                    }
+                }
                 else if (cmd == "attenuation") {
                     validinput = readvals(s, 3, values);
                     if (validinput) {
@@ -180,30 +345,35 @@ void Scene::readfile(const string &filename) {
 					validinput = readvals(s, 3, values) ;
                     if (validinput) {
 						materials.ambient = Color(values[0], values[1], values[2]); 
+						materialsChanged = true;
 					}
                 }
                 else if (cmd == "diffuse") {
 					validinput = readvals(s, 3, values) ; 
                     if (validinput) {
 						materials.diffuse = Color(values[0], values[1], values[2]); 
+						materialsChanged = true;
 					}
                 }
                 else if (cmd == "specular") {
 					validinput = readvals(s, 3, values) ; 
 					if (validinput) {
 						materials.specular = Color(values[0], values[1], values[2]); 
+						materialsChanged = true;
 					}
                 }
                 else if (cmd == "emission") {
                     validinput = readvals(s, 3, values) ; 
                     if (validinput) {
 						materials.emission = Color(values[0], values[1], values[2]); 
+						materialsChanged = true;
 					}
                 }
                 else if (cmd == "shininess") {
                     validinput = readvals(s, 1, values) ; 
                     if (validinput) {
 						materials.shininess = values[0] ; 
+						materialsChanged = true;
 					}
                 }
                
@@ -212,12 +382,14 @@ void Scene::readfile(const string &filename) {
                         validinput = readvals(s,3,values) ; 
                         if (validinput) {
                                 rightmultiply(Transform::translate(values[0], values[1], values[2]), transfstack);
+                                AddFixedStep(Transform::translate(values[0], values[1], values[2]), stepstack);
                         }
                 }
                 else if (cmd == "scale") {
                         validinput = readvals(s,3,values) ; 
                         if (validinput) {
                                 rightmultiply(Transform::scale(values[0], values[1], values[2]), transfstack);
+                                AddFixedStep(Transform::scale(values[0], values[1], values[2]), stepstack);
                         }
                 }
                 else if (cmd == "rotate") {
@@ -226,16 +398,43 @@ void Scene::readfile(const string &filename) {
                                 mat3 rot3 = Transform::rotate(values[3], vec3(values[0], values[1], values[2]));
                                 mat4 rot4(rot3);
                                 rightmultiply(rot4, transfstack);
+                                AddFixedStep(rot4, stepstack);
+                        }
+                }
+                // Keyframed: keytranslate t x y z [t x y z ...], keyscale likewise, keyrotate x y z t angle [t angle ...]
+                else if (cmd == "keytranslate" || cmd == "keyscale" || cmd == "keyrotate") {
+                        TransformStep step;
+                        step.type = cmd == "keytranslate"? TransformStep::translate : cmd == "keyscale"? TransformStep::scale : TransformStep::rotate;
+                        validinput = step.type != TransformStep::rotate || readvals(s, 3, values);
+                        if (validinput && step.type == TransformStep::rotate) {
+                                step.axis = vec3(values[0], values[1], values[2]);
+                        }
+                        validinput = validinput && readkeys(s, step.type == TransformStep::rotate? 1 : 3, step.keys);
+                        if (validinput) {
+                                // The level starts with the matrix of the commands before
+                                if (stepstack.top().empty()) {
+                                        TransformStep before;
+                                        before.type = TransformStep::fixed;
+                                        before.matrix = transfstack.top();
+                                        stepstack.top().push_back(before);
+                                }
+                                stepstack.top().push_back(step);
+                                rightmultiply(step.At(0), transfstack);
                         }
                 }
 
                 // I include the basic push/pop code for matrix stacks
-                else if (cmd == "pushTransform") 
+                else if (cmd == "pushTransform") {
                         transfstack.push(transfstack.top()) ; 
+                        stepstack.push(stepstack.top());
+                }
                 else if (cmd == "popTransform") {
                         if (transfstack.size() <= 1) 
                                 cerr << "Stack has no elements.  Cannot Pop\n" ; 
-                        else transfstack.pop() ; 
+                        else {
+                                transfstack.pop() ; 
+                                stepstack.pop();
+                        }
                 }
 
                 else {
@@ -243,10 +442,22 @@ void Scene::readfile(const string &filename) {
                 }
                 getline (in, str) ; 
 		}
+		lightTree.Build(lights);
+		bvh.Build(objects);
 		cout << "Reading of " << filename << " finished successfully\n";
 }
-Scene::Scene() {
+// Defaults of the scene file format for the commands a file may leave out
+Scene::Scene() : materialsChanged(false), currentMaterial(0), currentTransform(NULL), maxDepth(5), width(0), height(0), time(0) {
+    attenuation[0] = 1.0;
+    attenuation[1] = 0.0;
+    attenuation[2] = 0.0;
 }
 
 Scene::~Scene() {
+    for (int i = 0; i < (int)objects.size(); ++i) {
+        delete objects[i];
+    }
+    for (int i = 0; i < (int)transformTable.size(); ++i) {
+        delete transformTable[i];
+    }
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include <stack>
 #include <sstream>
 #include "geometry.h"
+#include "lighttree.h"
+#include "bvh.h"
 using namespace std;
 
 #ifndef SCENE_H
@@ -24,16 +26,44 @@ struct Light {
     vec3 transform; // Lights transformed by modelview
     Color color; // Light Colors
          
-    enum Type {directional, point};
+    enum Type {directional, point, quad, sphere};
     Type type;
-    const vec3& position() const; // For point lights
+    vec3 edgeU, edgeV; // Sides of a quad light, centered on its position
+    float radius; // Of a sphere light
+    const vec3& position() const; // For point lights, the center of area lights
     const vec3& direction() const; // For directional lights
+    bool IsAreaLight() const { return type == quad || type == sphere; }
+};
+
+// One factor of the matrix stack as the commands built it: a fixed matrix, or a keyframed command
+// whose values at the sequence time t (0 to 1) are interpolated between its keys
+struct TransformStep {
+    enum Type {fixed, translate, rotate, scale};
+    Type type;
+    mat4 matrix; // Of a fixed step
+    vec3 axis; // Of a rotation, only the angle is keyed
+    vector<float> keys; // Groups of a time and its values (x y z, or the angle), times increasing
+    mat4 At(float t) const;
+    bool operator == (const TransformStep& other) const;
+};
+
+// Object transform that follows keyframes: its matrix is the product of the steps, in command order
+struct AnimatedTransform {
+    ObjectTransform* entry; // In Scene::transformTable, shared by the objects made under these steps
+    vector<TransformStep> steps;
 };
 
 class Scene
 {
 private:
 	bool readvals (stringstream &s, const int numvals, float *values) ;
+    bool readkeys(stringstream &s, const int numvals, vector<float>& keys); // One or more groups of a time and numvals values
+    MaterialId InternMaterials(); // Table entry for the current material state
+    bool materialsChanged; // Material commands seen since the last interned entry
+    MaterialId currentMaterial;
+    // Shared entry for the current stack matrix, or for the steps when a keyframed command made them
+    const ObjectTransform* InternTransform(const mat4& top, const vector<TransformStep>& steps);
+    const ObjectTransform* currentTransform; // Last fixed entry
 
 public:
 	Scene();
@@ -49,12 +79,23 @@ public:
     int width, height;
 
     vector<Light> lights;
+    LightTree lightTree; // Built from the lights once the file is read
 
     Materials materials; // Global material
+    vector<Materials> materialTable; // Distinct materials, shared by objects through Object::materialId
+    const Materials& GetMaterials(const Object* object) const;
     float attenuation[3]; 
     
     // For multiple objects 
     vector<Object*> objects;
+    ObjectBVH bvh; // Built from the objects once the file is read
+    vector<ObjectTransform*> transformTable; // Distinct object transforms, owned by the scene
+    vector<AnimatedTransform> animatedTransforms; // Entries of the table that keyframes move
+    float time; // Sequence time of the animated transforms, 0 after reading
+
+    // Moves the animated transforms to the sequence time t, false when no matrix changed. The BVH
+    // is left to the caller
+    bool SetTime(float t);
 
 	int maxVerts, maxVertNorms;
 
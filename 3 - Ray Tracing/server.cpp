@@ -0,0 +1,230 @@
+#include <iostream>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "server.h"
+#include "render.h"
+#include "stats.h"
+#include "incremental.h"
+#include "savequeue.h"
+
+SceneCache::SceneCache(int _capacity) : hits(0), misses(0), capacity(_capacity) {}
+
+SceneCache::~SceneCache() {
+    for (list<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        delete it->scene;
+    }
+}
+
+// Modification time and size of the file, false when it can't be read. Where the system keeps
+// nanoseconds they count too
+static bool FileStamp(const string& filename, long long& seconds, long& nanoseconds, long long& size) {
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(filename.c_str(), &info) != 0) {
+        return false;
+    }
+    nanoseconds = 0;
+#else
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) {
+        return false;
+    }
+#ifdef __APPLE__
+    nanoseconds = info.st_mtimespec.tv_nsec;
+#else
+    nanoseconds = info.st_mtim.tv_nsec;
+#endif
+#endif
+    seconds = info.st_mtime;
+    size = info.st_size;
+    return true;
+}
+
+Scene* SceneCache::Get(const string& filename, Scene** replaced) {
+    long long mtime, size;
+    long mtimeNs;
+    if (!FileStamp(filename, mtime, mtimeNs, size)) {
+        cerr << "Open " << filename << " failed!" << endl;
+        throw 2;
+    }
+
+    for (list<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        if (it->filename != filename) {
+            continue;
+        }
+        if (it->mtime != mtime || it->mtimeNs != mtimeNs || it->size != size) { // Edited since it was parsed
+            if (replaced != NULL) {
+                *replaced = it->scene;
+            }
+            else {
+                delete it->scene;
+            }
+            entries.erase(it);
+            break;
+        }
+        entries.splice(entries.begin(), entries, it);
+        Entry& entry = entries.front();
+        entry.scene->camera = entry.camera;
+        entry.scene->width = entry.width;
+        entry.scene->height = entry.height;
+        entry.scene->maxDepth = entry.maxDepth;
+        entry.scene->resultFile = entry.resultFile;
+        hits++;
+        return entry.scene;
+    }
+
+    misses++;
+    Scene* scene = new Scene();
+    try {
+        scene->readfile(filename);
+    }
+    catch (int) {
+        delete scene;
+        if (replaced != NULL) {
+            delete *replaced;
+            *replaced = NULL;
+        }
+        throw;
+    }
+    if ((int)entries.size() >= capacity) {
+        delete entries.back().scene;
+        entries.pop_back();
+    }
+    Entry entry;
+    entry.filename = filename;
+    entry.mtime = mtime;
+    entry.mtimeNs = mtimeNs;
+    entry.size = size;
+    entry.scene = scene;
+    entry.camera = scene->camera;
+    entry.width = scene->width;
+    entry.height = scene->height;
+    entry.maxDepth = scene->maxDepth;
+    entry.resultFile = scene->resultFile;
+    entries.push_front(entry);
+    return scene;
+}
+
+bool ApplyOverrides(stringstream& s, Scene& scene) {
+    string cmd;
+    while (s >> cmd) {
+        if (cmd == "output") {
+            s >> scene.resultFile;
+        }
+        else if (cmd == "size") {
+            s >> scene.width >> scene.height;
+            if (!s.fail() && (scene.width <= 0 || scene.height <= 0 || scene.width > MAX_IMAGE_SIZE || scene.height > MAX_IMAGE_SIZE)) {
+                cerr << "Size out of range: " << scene.width << " " << scene.height << "\n";
+                return false;
+            }
+        }
+        else if (cmd == "maxdepth") {
+            s >> scene.maxDepth;
+        }
+        else if (cmd == "camera") {
+            float values[10];
+            for (int i = 0; i < 10; ++i) {
+                s >> values[i];
+            }
+            scene.camera = Camera(vec3(values[0], values[1], values[2]), vec3(values[3], values[4], values[5]),
+                vec3(values[6], values[7], values[8]), values[9]);
+        }
+        else {
+            cerr << "Unknown override: " << cmd << "\n";
+            return false;
+        }
+        if (s.fail()) {
+            cerr << "Failed reading values of " << cmd << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// A job line comes once the image of the job is saved, so it goes through the queue when there is one
+static void Report(SaveQueue* queue, const string& line) {
+    if (queue != NULL) {
+        queue->Print(line);
+    }
+    else {
+        cout << line << flush;
+    }
+}
+
+int RunServer(istream& in, const RenderOptions& options) {
+    SceneCache cache(options.cacheSize);
+    int job = 0, rendered = 0;
+    string line;
+
+    // With --incremental the last frame is kept, an edit of its file only re-traces what changed
+    IncrementalFrame last;
+    string lastFile;
+    // Every light is shaded, as in the G-buffer the frame keeps; only the area light sampling follows the options
+    RayTracer ray_tracer(0.0, 0, options.packetSize, false, options.areaSamples, options.areaMaxSamples);
+    // With --save-queue the images are compressed and written while the next job is traced
+    SaveQueue* queue = options.saveQueue > 0? new SaveQueue(options.saveQueue) : NULL;
+
+    cout << "Render server ready.\n" << flush;
+    while (getline(in, line)) {
+        stringstream s(line);
+        string filename;
+        if (!(s >> filename) || filename[0] == '#') {
+            continue;
+        }
+        if (filename == "quit") {
+            break;
+        }
+        job++;
+        stringstream report;
+        report << "Job " << job;
+        
+        Scene* scene;
+        Scene* replaced = NULL;
+        int misses = cache.misses;
+        try {
+            scene = cache.Get(filename, options.incremental? &replaced : NULL);
+        }
+        catch (int) {
+            report << " failed: cannot read " << filename << "\n";
+            Report(queue, report.str());
+            continue;
+        }
+        if (!ApplyOverrides(s, *scene)) {
+            report << " failed: bad overrides\n";
+            Report(queue, report.str());
+            delete replaced;
+            continue;
+        }
+
+        RenderStats stats;
+        stats.Start();
+        int traced = -1;
+        if (options.incremental) {
+            // Unedited files are compared with themselves, only their overrides can change the frame.
+            // A file parsed again after an eviction has nothing to compare with
+            const Scene* previous = NULL;
+            if (filename == lastFile) {
+                previous = replaced != NULL? replaced : misses == cache.misses? scene : NULL;
+            }
+            traced = RenderIncremental(ray_tracer, *scene, previous, last);
+            lastFile = filename;
+            SaveFrame(last.frame, options, scene->resultFile, queue);
+            delete replaced;
+        }
+        else {
+            RenderToFile(scene->camera, *scene, options, scene->resultFile, queue);
+        }
+        stats.Stop();
+        rendered++;
+
+        report << " done: " << scene->resultFile << " in " << stats.milliseconds << " ms"
+               << " (scene cache " << cache.hits << " hits, " << cache.misses << " misses";
+        if (traced >= 0) {
+            report << ", traced " << traced << " of " << scene->width * scene->height << " pixels";
+        }
+        report << ")\n";
+        Report(queue, report.str());
+    }
+    delete queue; // Waits for the last images
+    return rendered;
+}
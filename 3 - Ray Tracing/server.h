@@ -0,0 +1,43 @@
+#include <list>
+#include "scene.h"
+#include "options.h"
+
+#ifndef SERVER_H
+#define SERVER_H
+
+// Parsed scenes kept between render jobs. An entry is parsed again when the file
+// changed on disk, and the least recently used one goes when the cache is full
+class SceneCache {
+public:
+    SceneCache(int _capacity);
+    ~SceneCache();
+    
+    // The scene with the camera, size, depth and output of its file, whatever the previous job changed.
+    // When the file was edited the old scene goes to *replaced (the caller deletes it) if it is given
+    Scene* Get(const string& filename, Scene** replaced = NULL);
+    int hits, misses;
+
+private:
+    struct Entry {
+        string filename;
+        // Seconds alone miss an edit saved in the second of the parse
+        long long mtime;
+        long mtimeNs;
+        long long size;
+        Scene* scene;
+        // Values from the file, jobs override them on the shared scene
+        Camera camera;
+        int width, height, maxDepth;
+        string resultFile;
+    };
+    list<Entry> entries; // Most recently used first
+    int capacity;
+};
+
+// Applies the "output", "size", "camera" and "maxdepth" overrides of a job line, false for an unknown
+// override or bad values (a size must be 1 to 16384)
+bool ApplyOverrides(stringstream& s, Scene& scene);
+
+// One job per line until "quit" or the end of the input, returns the number of rendered frames
+int RunServer(istream& in, const RenderOptions& options);
+#endif // SERVER_H
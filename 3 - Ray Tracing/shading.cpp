@@ -0,0 +1,173 @@
+#include <cmath>
+#include "shading.h"
+
+// Largest shininess done by squaring, the bound of the header holds up to here
+static const float MAX_SQUARED_SHININESS = 4096;
+
+float PowShininess(float x, float shininess) {
+    if (shininess < 0 || shininess > MAX_SQUARED_SHININESS || shininess != floor(shininess)) {
+        return pow(x, shininess);
+    }
+    unsigned int n = shininess;
+    float result = 1, base = x;
+    while (n != 0) {
+        if (n & 1) {
+            result *= base;
+        }
+        n >>= 1;
+        if (n != 0) {
+            base *= base;
+        }
+    }
+    return result;
+}
+
+// Same powers as PowShininess, the squaring runs over all the lanes at once
+static void PowLanes(float* x, int lanes, float shininess) {
+    if (shininess < 0 || shininess > MAX_SQUARED_SHININESS || shininess != floor(shininess)) {
+        for (int k = 0; k < lanes; ++k) {
+            x[k] = pow(x[k], shininess);
+        }
+        return;
+    }
+    float result[SHADING_LANES], base[SHADING_LANES];
+    for (int k = 0; k < SHADING_LANES; ++k) {
+        result[k] = 1;
+        base[k] = x[k];
+    }
+    for (unsigned int n = shininess; n != 0; ) {
+        if (n & 1) {
+            for (int k = 0; k < SHADING_LANES; ++k) {
+                result[k] *= base[k];
+            }
+        }
+        n >>= 1;
+        if (n != 0) {
+            for (int k = 0; k < SHADING_LANES; ++k) {
+                base[k] *= base[k];
+            }
+        }
+    }
+    for (int k = 0; k < lanes; ++k) {
+        x[k] = result[k];
+    }
+}
+
+ShadingPoint::ShadingPoint(const vec3& _position, const vec3& unitNormal, const vec3& viewDirection, const Materials& _materials) : 
+    position(_position), normal(unitNormal), toEye(glm::normalize(-viewDirection)), materials(&_materials) {}
+
+// Lanes of one block of lights: the geometry fills them, the color kernel turns them into colors
+struct LightLanes {
+    float nDotL[SHADING_LANES], power[SHADING_LANES], scale[SHADING_LANES];
+    float red[SHADING_LANES], green[SHADING_LANES], blue[SHADING_LANES];
+};
+
+// Directions of lanes [first, end), all lights of one type. The attenuation of a point light is 1 exactly
+// when the scene keeps the default (1, 0, 0), so that case doesn't divide at all. The half vector is only
+// worked out for a specular material
+template <bool point, bool specular, bool attenuated>
+static void LightGeometry(const ShadingPoint& shading, const vector<Light>& lights, const int* indices, int first, int end,
+                          const float* attenuation, LightLanes& lanes) {
+    for (int k = first; k < end; ++k) {
+        const Light& light = lights[indices[k]];
+        vec3 lightDirection;
+        if (point) { // POINT LIGHT
+            lightDirection = glm::normalize(light.position() - shading.position);
+            if (attenuated) {
+                float d = glm::length(light.position() - shading.position);
+                lanes.scale[k] = 1.0 / (attenuation[0] + attenuation[1] * d + attenuation[2] * pow(d, 2));
+            }
+        }
+        else { // DIRECTIONAL LIGHT
+            lightDirection = glm::normalize(light.direction());
+            if (attenuated) {
+                lanes.scale[k] = 1; // Exact, the directional light colors are left as they are
+            }
+        }
+        lanes.nDotL[k] = max(glm::dot(shading.normal, lightDirection), 0.0f);
+        if (specular) {
+            vec3 halfvec = glm::normalize(lightDirection + shading.toEye);
+            lanes.power[k] = max(glm::dot(shading.normal, halfvec), 0.0f);
+        }
+        lanes.red[k] = light.color.r;
+        lanes.green[k] = light.color.g;
+        lanes.blue[k] = light.color.b;
+    }
+}
+
+// diffuse * light * nDotL + specular * light * nDotH^shininess, attenuated, channel by channel. Without
+// specular the second term is exactly zero and is left out, without attenuation the scale is 1
+template <bool specular, bool attenuated>
+static void LightColors(const Materials& materials, LightLanes& lanes) {
+    for (int k = 0; k < SHADING_LANES; ++k) {
+        float red = materials.diffuse.r * lanes.red[k] * lanes.nDotL[k];
+        float green = materials.diffuse.g * lanes.green[k] * lanes.nDotL[k];
+        float blue = materials.diffuse.b * lanes.blue[k] * lanes.nDotL[k];
+        if (specular) {
+            red = red + materials.specular.r * lanes.red[k] * lanes.power[k];
+            green = green + materials.specular.g * lanes.green[k] * lanes.power[k];
+            blue = blue + materials.specular.b * lanes.blue[k] * lanes.power[k];
+        }
+        if (attenuated) {
+            red *= lanes.scale[k];
+            green *= lanes.scale[k];
+            blue *= lanes.scale[k];
+        }
+        lanes.red[k] = red;
+        lanes.green[k] = green;
+        lanes.blue[k] = blue;
+    }
+}
+
+template <bool specular, bool attenuated>
+static Color ShadeLightsWith(const ShadingPoint& shading, const vector<Light>& lights, const int* indices, const float* weights, int count,
+                             const float* attenuation, Color color) {
+    const Materials& materials = *shading.materials;
+    // The full width loops also run over the lanes past count, their values are never added
+    LightLanes lanes = {};
+    for (int first = 0; first < count; first += SHADING_LANES) {
+        int used = min(SHADING_LANES, count - first);
+        const int* block = indices + first;
+
+        // Runs of lights of the same type share one geometry kernel, the type is tested once per run
+        for (int k = 0; k < used; ) {
+            Light::Type type = lights[block[k]].type;
+            int end = k + 1;
+            while (end < used && lights[block[end]].type == type) {
+                end++;
+            }
+            if (type == Light::point) {
+                LightGeometry<true, specular, attenuated>(shading, lights, block, k, end, attenuation, lanes);
+            }
+            else {
+                LightGeometry<false, specular, attenuated>(shading, lights, block, k, end, attenuation, lanes);
+            }
+            k = end;
+        }
+        if (specular) {
+            PowLanes(lanes.power, used, materials.shininess);
+        }
+        LightColors<specular, attenuated>(materials, lanes);
+
+        // Added in order, the sum is the same as light by light
+        for (int k = 0; k < used; ++k) {
+            float weight = weights[first + k];
+            color = color + Color(lanes.red[k] * weight, lanes.green[k] * weight, lanes.blue[k] * weight);
+        }
+    }
+    return color;
+}
+
+Color ShadeLights(const ShadingPoint& shading, const vector<Light>& lights, const int* indices, const float* weights, int count,
+                  const float* attenuation, Color color) {
+    // Exactly zero, a dark but nonzero specular still counts
+    const Color& specular = shading.materials->specular;
+    bool hasSpecular = specular.r != 0 || specular.g != 0 || specular.b != 0;
+    bool attenuated = attenuation[0] != 1 || attenuation[1] != 0 || attenuation[2] != 0;
+    if (hasSpecular) {
+        return attenuated? ShadeLightsWith<true, true>(shading, lights, indices, weights, count, attenuation, color) :
+            ShadeLightsWith<true, false>(shading, lights, indices, weights, count, attenuation, color);
+    }
+    return attenuated? ShadeLightsWith<false, true>(shading, lights, indices, weights, count, attenuation, color) :
+        ShadeLightsWith<false, false>(shading, lights, indices, weights, count, attenuation, color);
+}
\ No newline at end of file
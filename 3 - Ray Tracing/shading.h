@@ -0,0 +1,31 @@
+#include <vector>
+#include "scene.h"
+using namespace std;
+
+#ifndef SHADING_H
+#define SHADING_H
+
+// Lights shaded together per step, the lanes of the kernel below
+const int SHADING_LANES = 8;
+
+// x^shininess for x in [0, 1]. A whole shininess n up to 4096 is done by repeated squaring. Each squaring
+// doubles the relative error it got, so the result is within about (n-1) 2^-24 of pow relative: 6e-6 at
+// 100, 6e-5 at 1000, 2.4e-4 at 4096 (a sixteenth of the 1/255 of a byte). Any other shininess goes to pow
+float PowShininess(float x, float shininess);
+
+// What the lights of one hit share, worked out once per hit instead of once per light
+struct ShadingPoint {
+    vec3 position;
+    vec3 normal; // Unit vector
+    vec3 toEye; // Unit vector, opposite of the view direction
+    const Materials* materials;
+    ShadingPoint(const vec3& _position, const vec3& unitNormal, const vec3& viewDirection, const Materials& _materials);
+};
+
+// color + weights[0] * light 0 + weights[1] * light 1 ... with Blinn-Phong and the point light attenuation,
+// added in the order of indices like a loop over the lights. The geometry is scalar, the color math
+// and the powers run over SHADING_LANES lights at a time. Kernels are compiled for each light type, with
+// and without specular and attenuation, and picked once per hit. Out of line so it has its own profile line
+Color ShadeLights(const ShadingPoint& point, const vector<Light>& lights, const int* indices, const float* weights, int count,
+                  const float* attenuation, Color color);
+#endif // SHADING_H
\ No newline at end of file
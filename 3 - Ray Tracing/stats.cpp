@@ -0,0 +1,102 @@
+#include "stats.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+PerfCounter::PerfCounter(unsigned long long config) : fd(-1) {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1; // Count the render threads too
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+PerfCounter::~PerfCounter() {
+#ifdef __linux__
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+}
+
+void PerfCounter::Start() {
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+long long PerfCounter::Stop() {
+    long long count = -1;
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+            count = -1;
+        }
+    }
+#endif
+    return count;
+}
+
+TraceCounters traceCounters = {0, 0, 0, 0, 0};
+
+#ifdef __linux__
+RenderStats::RenderStats() : milliseconds(0), cacheMisses(-1), cacheReferences(-1), shadowRays(0), occluderHits(0), nodeVisits(0), softShadows(0), softShadowSamples(0),
+    misses(PERF_COUNT_HW_CACHE_MISSES), references(PERF_COUNT_HW_CACHE_REFERENCES) {}
+#else
+RenderStats::RenderStats() : milliseconds(0), cacheMisses(-1), cacheReferences(-1), shadowRays(0), occluderHits(0), nodeVisits(0), softShadows(0), softShadowSamples(0), misses(0), references(0) {}
+#endif
+
+void RenderStats::Start() {
+    misses.Start();
+    references.Start();
+    countersStart = traceCounters;
+    start = chrono::steady_clock::now();
+}
+
+void RenderStats::Stop() {
+    milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cacheMisses = misses.Stop();
+    cacheReferences = references.Stop();
+    shadowRays = traceCounters.shadowRays - countersStart.shadowRays;
+    occluderHits = traceCounters.occluderHits - countersStart.occluderHits;
+    nodeVisits = traceCounters.nodeVisits - countersStart.nodeVisits;
+    softShadows = traceCounters.softShadows - countersStart.softShadows;
+    softShadowSamples = traceCounters.softShadowSamples - countersStart.softShadowSamples;
+}
+
+void RenderStats::Print(ostream& out) const {
+    out << "Render time: " << milliseconds << " ms;";
+    if (cacheMisses >= 0 && cacheReferences > 0) {
+        out << " Cache misses: " << cacheMisses << " of " << cacheReferences << " references (" 
+            << 100.0 * cacheMisses / cacheReferences << "%);";
+    }
+    else {
+        out << " Cache misses: not available;";
+    }
+    if (shadowRays > 0) {
+        out << " Shadow rays: " << shadowRays << ", " << occluderHits << " answered by the last occluder ("
+            << 100.0 * occluderHits / shadowRays << "%);";
+    }
+    if (nodeVisits > 0) {
+        out << " BVH node visits: " << nodeVisits << ";";
+    }
+    if (softShadows > 0) {
+        out << " Area light samples: " << (double)softShadowSamples / softShadows << " per shaded light;";
+    }
+    out << "\n";
+}
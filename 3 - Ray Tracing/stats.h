@@ -0,0 +1,44 @@
+#include <iostream>
+#include <chrono>
+using namespace std;
+
+#ifndef STATS_H
+#define STATS_H
+
+// Hardware counter read through perf_event, only on Linux
+class PerfCounter {
+public:
+    PerfCounter(unsigned long long config);
+    ~PerfCounter();
+    bool Available() const { return fd >= 0; }
+    void Start();
+    long long Stop(); // -1 when the counter is not available
+private:
+    int fd;
+};
+
+// Tracing work of the process: shadow rays, how many the last occluder of their light answered,
+// BVH nodes visited (once per packet for packets), and area lights shaded with their shadow samples.
+// Each RayTracer adds its counts when it is destroyed
+struct TraceCounters {
+    long long shadowRays, occluderHits, nodeVisits, softShadows, softShadowSamples;
+};
+extern TraceCounters traceCounters;
+
+// Wall clock time and cache counters around a render, printed with --stats
+class RenderStats {
+public:
+    RenderStats();
+    void Start();
+    void Stop();
+    void Print(ostream& out) const;
+
+    double milliseconds;
+    long long cacheMisses, cacheReferences;
+    long long shadowRays, occluderHits, nodeVisits, softShadows, softShadowSamples;
+private:
+    chrono::steady_clock::time_point start;
+    TraceCounters countersStart;
+    PerfCounter misses, references;
+};
+#endif // STATS_H
@@ -0,0 +1,189 @@
+#include <iostream>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include "tonemap.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TONEMAP_SSE2
+#endif
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+// Colors are read as a flat array of floats, every channel goes through the same curve
+static_assert(sizeof(Color) == 3 * sizeof(float), "Color must be three packed floats");
+
+// Scalar version of the SIMD lanes below, also used for the last floats of a row. NaN and negatives
+// give 0, infinity becomes the largest float, which the curve takes to 1 instead of Inf/Inf
+inline BYTE ToneMapChannel(float value, float exposure, bool reinhard, float invGamma) {
+    value *= exposure;
+    if (!(value > 0.0f)) {
+        value = 0.0f;
+    }
+    value = std::min(value, FLT_MAX);
+    if (reinhard) {
+        value = value / (1.0f + value);
+    }
+    value = std::min(value, 1.0f);
+    if (invGamma != 1.0f) {
+        value = pow(value, invGamma);
+    }
+    return (BYTE)(value * 255);
+}
+
+void ToneMapRow(const Color* colors, int width, const RenderOptions& options, BYTE* out, bool bgr) {
+    const float* in = &colors[0].r;
+    int count = 3 * width;
+    float exposure = pow(2.0f, options.exposure);
+    bool reinhard = options.toneOperator == RenderOptions::reinhardTone;
+    float invGamma = 1.0f / options.gamma;
+    int i = 0;
+
+#ifdef TONEMAP_SSE2
+    // Four channels at a time, gamma is left to the scalar pow
+    if (invGamma == 1.0f) {
+        const __m128 scale = _mm_set1_ps(exposure);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 full = _mm_set1_ps(255.0f);
+        const __m128 largest = _mm_set1_ps(FLT_MAX);
+        for ( ; i + 4 <= count; i += 4) {
+            // max returns its second operand for NaN, so NaN becomes 0 like in the scalar version
+            __m128 v = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), zero);
+            v = _mm_min_ps(v, largest);
+            if (reinhard) {
+                v = _mm_div_ps(v, _mm_add_ps(one, v));
+            }
+            v = _mm_min_ps(v, one);
+            __m128i bytes = _mm_cvttps_epi32(_mm_mul_ps(v, full));
+            bytes = _mm_packs_epi32(bytes, bytes);
+            bytes = _mm_packus_epi16(bytes, bytes);
+            int packed = _mm_cvtsi128_si32(bytes);
+            memcpy(out + i, &packed, 4);
+        }
+    }
+#endif
+    for ( ; i < count; i++) {
+        out[i] = ToneMapChannel(in[i], exposure, reinhard, invGamma);
+    }
+
+    if (bgr) {
+        for (int x = 0; x < width; x++) {
+            std::swap(out[3*x], out[3*x + 2]);
+        }
+    }
+}
+
+PfmWriter::PfmWriter() : file(NULL), width(0), height(0), dataStart(0), ok(false) {}
+
+PfmWriter::~PfmWriter() {
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+bool PfmWriter::Open(const string& fname, int _width, int _height) {
+    file = fopen(fname.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    width = _width;
+    height = _height;
+    // The floats are written in host order, a negative scale means little endian
+    const unsigned int probe = 1;
+    bool littleEndianHost = *(const unsigned char*)&probe == 1;
+    ok = fprintf(file, "PF\n%d %d\n%s\n", width, height, littleEndianHost ? "-1.0" : "1.0") > 0;
+    dataStart = ftell(file);
+    return ok;
+}
+
+bool PfmWriter::WriteRows(const FrameBuffer& frame, int firstRow, int count) {
+    vector<float> row(3 * width);
+    for (int y = firstRow; y < firstRow + count && ok; y++) {
+        const Color* colors = &frame.colors[(y - frame.originY) * frame.width];
+        for (int x = 0; x < width; x++) {
+            row[3*x + 0] = colors[x].r;
+            row[3*x + 1] = colors[x].g;
+            row[3*x + 2] = colors[x].b;
+        }
+        long long offset = dataStart + (long long)(height - 1 - y) * width * 3 * sizeof(float);
+        ok = fseek64(file, offset, SEEK_SET) == 0 && fwrite(&row[0], sizeof(float), row.size(), file) == row.size();
+    }
+    return ok;
+}
+
+bool PfmWriter::Close() {
+    if (file == NULL) {
+        return false;
+    }
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+    return ok;
+}
+
+bool WritePfm(const string& fname, const FrameBuffer& frame) {
+    PfmWriter pfm;
+    if (!pfm.Open(fname, frame.width, frame.height)) {
+        return false;
+    }
+    pfm.WriteRows(frame, frame.originY, frame.height);
+    return pfm.Close();
+}
+
+bool ReadPfm(const string& fname, FrameBuffer& frame) {
+    FILE* file = fopen(fname.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char magic[3] = {0};
+    int width, height;
+    float scale;
+    if (fscanf(file, "%2s %d %d %f", magic, &width, &height, &scale) != 4 || strcmp(magic, "PF") != 0 ||
+        width <= 0 || height <= 0 || width > MAX_IMAGE_SIZE || height > MAX_IMAGE_SIZE) {
+        fclose(file);
+        return false;
+    }
+    fgetc(file); // Single whitespace before the data
+
+    const unsigned int probe = 1;
+    bool littleEndianHost = *(const unsigned char*)&probe == 1;
+    bool swap = (scale < 0) != littleEndianHost;
+
+    frame = FrameBuffer(width, height);
+    vector<float> row(3 * width);
+    bool ok = true;
+    for (int y = height - 1; y >= 0 && ok; y--) {
+        ok = fread(&row[0], sizeof(float), row.size(), file) == row.size();
+        for (int i = 0; swap && i < (int)row.size(); i++) {
+            unsigned char* b = (unsigned char*)&row[i];
+            std::swap(b[0], b[3]);
+            std::swap(b[1], b[2]);
+        }
+        for (int x = 0; x < width; x++) {
+            frame.ColorAt(x, y) = Color(row[3*x + 0], row[3*x + 1], row[3*x + 2]);
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+int RunToneMap(const RenderOptions& options) {
+    FrameBuffer frame(0, 0);
+    if (!ReadPfm(options.toneMapInput, frame)) {
+        cerr << "Reading " << options.toneMapInput << " failed!" << endl;
+        return 1;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<BYTE> image(3 * frame.width * frame.height);
+    for (int y = 0; y < frame.height; y++) {
+        ToneMapRow(&frame.ColorAt(0, y), frame.width, options, &image[3 * (frame.height-y-1) * frame.width], true);
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "Tone mapping: " << ms << " ms\n";
+    SaveScreenshot(options.toneMapOutput, &image[0], frame.width, frame.height);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#include <cstdio>
+#include "render.h"
+
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+// Exposure, tone curve and gamma from the float colors to 8 bits per channel, RGB order
+// (or BGR for FreeImage). The default settings give the same bytes as Color::Rbyte
+void ToneMapRow(const Color* colors, int width, const RenderOptions& options, BYTE* out, bool bgr = false);
+
+// Raw float RGB image, rows stored from bottom to top. Rows can be written in any order,
+// so a streamed render writes each band where it belongs
+class PfmWriter {
+public:
+    PfmWriter();
+    ~PfmWriter();
+    bool Open(const string& fname, int _width, int _height);
+    bool WriteRows(const FrameBuffer& frame, int firstRow, int count); // Image rows firstRow.. of the frame
+    bool Close();
+private:
+    FILE* file;
+    int width, height;
+    long long dataStart;
+    bool ok;
+};
+
+bool WritePfm(const string& fname, const FrameBuffer& frame);
+bool ReadPfm(const string& fname, FrameBuffer& frame);
+
+// --tonemap: re-exposes a saved PFM into a PNG without tracing anything
+int RunToneMap(const RenderOptions& options);
+#endif // TONEMAP_H
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include "traversal.h"
+
+// Even bits of d give x and odd bits give y
+void MortonToXY(unsigned int d, int* x, int* y) {
+    *x = *y = 0;
+    for (int bit = 0; bit < 16; ++bit) {
+        *x |= ((d >> (2*bit)) & 1) << bit;
+        *y |= ((d >> (2*bit + 1)) & 1) << bit;
+    }
+}
+
+void HilbertToXY(int n, unsigned int d, int* x, int* y) {
+    *x = *y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        // Rotate the quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                *x = s-1 - *x;
+                *y = s-1 - *y;
+            }
+            int tmp = *x;
+            *x = *y;
+            *y = tmp;
+        }
+        *x += s * rx;
+        *y += s * ry;
+        d /= 4;
+    }
+}
+
+void BuildTiles(int width, int height, const RenderOptions& options, vector<Tile>& tiles, int originX, int originY) {
+    tiles.clear();
+    int size = options.tileSize;
+
+    // Plain scanlines, the whole image is one tile
+    if (options.order == RenderOptions::rowMajor && size == 1) {
+        tiles.push_back(Tile(originX, originY, originX + width, originY + height));
+        return;
+    }
+
+    int tilesX = (width + size - 1) / size;
+    int tilesY = (height + size - 1) / size;
+    if (options.order == RenderOptions::rowMajor) {
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                tiles.push_back(Tile(originX + tx*size, originY + ty*size, originX + min((tx+1)*size, width), originY + min((ty+1)*size, height)));
+            }
+        }
+        return;
+    }
+
+    // The curves cover power of two squares as wide as the short side, laid one after the other along
+    // the long side, and the cells outside the image are skipped. A thin band walks about its own
+    // cells instead of the square of its width
+    int n = 1;
+    while (n < min(tilesX, tilesY)) {
+        n *= 2;
+    }
+    bool alongX = tilesX >= tilesY;
+    int squares = ((alongX? tilesX : tilesY) + n - 1) / n;
+    unsigned long long cells = (unsigned long long)n * n;
+    tiles.reserve(tilesX * tilesY);
+    for (int q = 0; q < squares; ++q) {
+        for (unsigned long long d = 0; d < cells; ++d) {
+            int tx, ty;
+            if (options.order == RenderOptions::morton) {
+                MortonToXY((unsigned int)d, &tx, &ty);
+            }
+            else {
+                HilbertToXY(n, (unsigned int)d, &tx, &ty);
+            }
+            if (alongX) {
+                tx += q * n;
+            }
+            else {
+                ty += q * n;
+            }
+            if (tx < tilesX && ty < tilesY) {
+                tiles.push_back(Tile(originX + tx*size, originY + ty*size, originX + min((tx+1)*size, width), originY + min((ty+1)*size, height)));
+            }
+        }
+    }
+}
\ No newline at end of file
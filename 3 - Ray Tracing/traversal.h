@@ -0,0 +1,23 @@
+#include <vector>
+#include "options.h"
+using namespace std;
+
+#ifndef TRAVERSAL_H
+#define TRAVERSAL_H
+
+// Pixels [x0, x1) x [y0, y1) of the image, y going down like the RayTrace loop
+struct Tile {
+    int x0, y0, x1, y1;
+    Tile(int _x0, int _y0, int _x1, int _y1) : x0(_x0), y0(_y0), x1(_x1), y1(_y1) {}
+};
+
+// Space filling curve index d -> (x, y) on a n x n grid, n a power of two
+void MortonToXY(unsigned int d, int* x, int* y);
+void HilbertToXY(int n, unsigned int d, int* x, int* y);
+
+// Splits the image in tiles listed in traversal order. Successive tiles along
+// a Morton or Hilbert curve stay close, so their rays touch the same geometry.
+// Wide images and bands get a row of curves, one per square of the short side.
+// The tiles are shifted by the origin when the area is a band of the image
+void BuildTiles(int width, int height, const RenderOptions& options, vector<Tile>& tiles, int originX = 0, int originY = 0);
+#endif // TRAVERSAL_H